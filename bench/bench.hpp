@@ -0,0 +1,29 @@
+#ifndef _WOOF_bench_bench_hpp
+#define _WOOF_bench_bench_hpp
+
+#include "internal.hpp"
+#include <benchmark/benchmark.h>
+
+namespace woof::bench {
+
+inline std::shared_ptr<ServerState>
+make_state()
+{
+	return std::make_shared<ServerState>(
+		[](LogLevel, const char *, size_t) {},
+		"127.0.0.1",
+		0,
+		std::make_shared<RouterNode>()
+	);
+}
+
+// Does what Server::add_endpoint does, without needing a Server
+inline void
+add_endpoint(std::shared_ptr<ServerState> m, Method method, const PathPattern &path, const RequestHandler &handler)
+{
+	add_handler(m, method, path).handler = handler;
+}
+
+} // namespace woof::bench
+
+#endif
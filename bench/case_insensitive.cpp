@@ -0,0 +1,53 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+static const char *names[] {
+	"Host",
+	"Accept",
+	"Content-Type",
+	"Accept-Encoding",
+	"X-Forwarded-For",
+	"Access-Control-Allow-Credentials",
+};
+
+static void
+BM_CaseInsensitiveHash(benchmark::State &state)
+{
+	std::string name = names[state.range(0)];
+	CaseInsensitiveHash hash;
+	state.SetLabel(name);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(hash(name));
+	}
+	state.SetBytesProcessed(state.iterations() * name.size());
+}
+BENCHMARK(BM_CaseInsensitiveHash)->DenseRange(0, std::size(names) - 1);
+
+static void
+BM_CaseInsensitiveEquals(benchmark::State &state)
+{
+	std::string a = names[state.range(0)];
+	std::string b = a;
+	for (char &c : b) c = std::tolower(c);
+	CaseInsensitiveEquals equals;
+	state.SetLabel(a);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(equals(a, b));
+	}
+	state.SetBytesProcessed(state.iterations() * a.size());
+}
+BENCHMARK(BM_CaseInsensitiveEquals)->DenseRange(0, std::size(names) - 1);
+
+static void
+BM_HeaderMapFind(benchmark::State &state)
+{
+	HeaderMap headers;
+	for (const char *name : names) {
+		headers.emplace(name, "value");
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(headers.find("content-type"));
+	}
+}
+BENCHMARK(BM_HeaderMapFind);
@@ -0,0 +1,60 @@
+#include "bench.hpp"
+#include "connection.hpp"
+#include <boost/beast/_experimental/test/stream.hpp>
+
+using namespace woof;
+namespace asio = boost::asio;
+
+struct BenchMiddleware : public MiddlewareI {
+	virtual void before(Request &, Response &) override {}
+	virtual void after(Request &, Response &resp) override { resp.headers().emplace("X-Bench", "1"); }
+};
+
+static void
+BM_HandleConnection(benchmark::State &state)
+{
+	const int nmiddlewares = state.range(0);
+	const bool cached = state.range(1);
+	auto m = bench::make_state();
+	bench::add_endpoint(m, Method::GET, PathPattern::make<"/hello/{lang}">(),
+		[](Request &req, Response &resp) {
+			resp.body() << "Hello, " << req.path()["lang"] << ' ' << req.query().get_or<int>("a") << '\n';
+			resp.header(Field::CACHE_CONTROL, "max-age=3600");
+		}
+	);
+	if (cached) {
+		m->caches.emplace_back(PathPattern::make<"/**">(), std::make_shared<ResponseCacheState>(1 << 20, 16));
+	}
+	for (int i = 0; i < nmiddlewares; ++i) {
+		size_t hash = i;
+		m->mw_map[hash] = {[] { return new BenchMiddleware(); }, PathPattern::make<"/**">(), {}, i};
+		m->mw_list.push_back(hash);
+	}
+	
+	const std::string request =
+		"GET /hello/en?a=42 HTTP/1.1\r\n"
+		"Host: localhost:8042\r\n"
+		"User-Agent: woof_bench\r\n"
+		"Accept: */*\r\n"
+		"Accept-Encoding: gzip, deflate\r\n"
+		"\r\n";
+		
+	asio::io_context ioc;
+	auto round_trip = [&] {
+		beast::test::stream server(ioc), client(ioc);
+		server.connect(client);
+		server.append(request);
+		handle_connection(m, server);
+		return std::string(client.str());
+	};
+	
+	if (round_trip().find("Hello, en 42") == std::string::npos) {
+		state.SkipWithError("Unexpected response");
+		return;
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(round_trip());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HandleConnection)->ArgNames({"middlewares", "cached"})->Args({0, 0})->Args({4, 0})->Args({4, 1});
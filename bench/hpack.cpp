@@ -0,0 +1,56 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+static const std::pair<std::string, std::string> request_headers[] {
+	{":method", "GET"},
+	{":scheme", "http"},
+	{":path", "/hello/en?a=42"},
+	{":authority", "localhost:8042"},
+	{"user-agent", "woof_bench"},
+	{"accept", "*/*"},
+	{"accept-encoding", "gzip, deflate"},
+};
+
+static void
+BM_HpackEncode(benchmark::State &state)
+{
+	HpackEncoder encoder;
+	std::string out;
+	for (auto _ : state) {
+		out.clear();
+		encoder.begin(out);
+		for (auto &[name, value] : request_headers) {
+			encoder.encode(out, name, value);
+		}
+		benchmark::DoNotOptimize(out);
+	}
+}
+BENCHMARK(BM_HpackEncode);
+
+// The first block of a connection has literals to Huffman-decode, the following ones are indexed
+static void
+BM_HpackDecode(benchmark::State &state)
+{
+	const bool first = state.range(0);
+	HpackEncoder encoder;
+	std::string block;
+	for (int i = 0; i < (first ? 1 : 2); ++i) {
+		block.clear();
+		encoder.begin(block);
+		for (auto &[name, value] : request_headers) {
+			encoder.encode(block, name, value);
+		}
+	}
+	
+	HpackDecoder warm;
+	std::vector<std::pair<std::string, std::string>> headers;
+	if (!first) warm.decode(block, headers);
+	for (auto _ : state) {
+		HpackDecoder decoder = warm;
+		headers.clear();
+		benchmark::DoNotOptimize(decoder.decode(block, headers));
+	}
+	state.SetBytesProcessed(state.iterations() * block.size());
+}
+BENCHMARK(BM_HpackDecode)->ArgNames({"first"})->Arg(1)->Arg(0);
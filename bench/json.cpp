@@ -0,0 +1,65 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+struct Item {
+	std::string name;
+	int64_t id = 0;
+	double price = 0;
+	std::vector<std::string> tags;
+	using fields = FormFields<
+		FormField<"name", &Item::name>,
+		FormField<"id", &Item::id>,
+		FormField<"price", &Item::price>,
+		FormField<"tags", &Item::tags>
+	>;
+};
+
+// An object whose last member is the one looked up, after n items to skip
+static std::string
+make_document(int n)
+{
+	std::stringstream ss;
+	JsonWriter w(ss);
+	w.begin_object().key("items").begin_array();
+	for (int i = 0; i < n; ++i) {
+		w.value(Item{"item \"" + std::to_string(i) + "\" with a longer name", i, i * 1.25, {"a", "bb", "ccc"}});
+	}
+	w.end_array().member("total", n).end_object();
+	return ss.str();
+}
+
+static void
+BM_JsonLookup(benchmark::State &state)
+{
+	std::string doc = make_document(state.range(0));
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(JsonValue(doc)["total"].get<int>());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_JsonLookup)->ArgNames({"items"})->Arg(10)->Arg(1000);
+
+static void
+BM_JsonBind(benchmark::State &state)
+{
+	std::string doc = make_document(1);
+	JsonValue item = JsonValue(doc)["items"][0];
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(item.get<Item>());
+	}
+}
+BENCHMARK(BM_JsonBind);
+
+static void
+BM_JsonWrite(benchmark::State &state)
+{
+	Item item {"item \"1\" with a longer name", 1, 1.25, {"a", "bb", "ccc"}};
+	std::stringstream ss;
+	for (auto _ : state) {
+		ss.str({});
+		JsonWriter(ss).value(item);
+		benchmark::DoNotOptimize(ss);
+	}
+}
+BENCHMARK(BM_JsonWrite);
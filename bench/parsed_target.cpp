@@ -0,0 +1,25 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+static const char *targets[] {
+	"/",
+	"/hello/en",
+	"/users/12345/posts/678?sort=desc&limit=20",
+	"/search?q=hello%20world&lang=en&page=3",
+	"/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q/r/s/t",
+	"/q?a=1&b=2&c=3&d=4&e=5&f=6&g=7&h=8&i=9&j=10&k=11&l=12&m=13&n=14&o=15&p=16",
+};
+
+static void
+BM_ParsedTarget(benchmark::State &state)
+{
+	std::string_view target = targets[state.range(0)];
+	state.SetLabel(std::string(target));
+	for (auto _ : state) {
+		ParsedTarget pt(target);
+		benchmark::DoNotOptimize(pt);
+	}
+	state.SetBytesProcessed(state.iterations() * target.size());
+}
+BENCHMARK(BM_ParsedTarget)->DenseRange(0, std::size(targets) - 1);
@@ -0,0 +1,24 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+static void
+BM_PathPatternRuntime(benchmark::State &state)
+{
+	std::string pattern = "/users/{id}/posts/{post}/**";
+	for (auto _ : state) {
+		PathPattern pp = PathPattern::make(pattern);
+		benchmark::DoNotOptimize(pp);
+	}
+}
+BENCHMARK(BM_PathPatternRuntime);
+
+static void
+BM_PathPatternCompileTime(benchmark::State &state)
+{
+	for (auto _ : state) {
+		PathPattern pp = PathPattern::make<"/users/{id}/posts/{post}/**">();
+		benchmark::DoNotOptimize(pp);
+	}
+}
+BENCHMARK(BM_PathPatternCompileTime);
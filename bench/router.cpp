@@ -0,0 +1,67 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+static void
+noop_handler(Request &, Response &)
+{}
+
+// /api/v{i}/res{j}/{id} for i < nversions, j < nresources, plus a few globstar routes
+static std::shared_ptr<ServerState>
+make_routes(int nversions, int nresources)
+{
+	auto m = bench::make_state();
+	for (int i = 0; i < nversions; ++i) {
+		for (int j = 0; j < nresources; ++j) {
+			std::string prefix = "/api/v" + std::to_string(i) + "/res" + std::to_string(j);
+			bench::add_endpoint(m, Method::GET, PathPattern::make(prefix + "/{id}"), noop_handler);
+			bench::add_endpoint(m, Method::POST, PathPattern::make(prefix), noop_handler);
+		}
+		bench::add_endpoint(m, Method::GET, PathPattern::make("/api/v" + std::to_string(i) + "/**"), noop_handler);
+	}
+	return m;
+}
+
+static void
+BM_DfsRoute(benchmark::State &state)
+{
+	int nversions = state.range(0);
+	int nresources = state.range(1);
+	auto m = make_routes(nversions, nresources);
+	std::vector<std::vector<std::string>> paths {
+		{"api", "v" + std::to_string(nversions - 1), "res" + std::to_string(nresources - 1), "42"},
+		{"api", "v0", "res0", "42"},
+		{"api", "v0", "nope", "42"},
+	};
+	for (auto _ : state) {
+		for (auto &path : paths) {
+			RouteMatch match;
+			auto node = dfs_route(match, Method::GET, m->router, path, 0);
+			benchmark::DoNotOptimize(node);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * paths.size());
+	state.counters["routes"] = nversions * (2 * nresources + 1);
+}
+BENCHMARK(BM_DfsRoute)->Args({1, 4})->Args({4, 16})->Args({10, 1000});
+
+static void
+BM_ResolveMiddlewares(benchmark::State &state)
+{
+	const int n = state.range(0);
+	auto m = bench::make_state();
+	static const char *patterns[] { "/**", "/api/**", "/api/*/res1/{id}", "/api/v0/*/*", "/other/**", "/api/v0/res1/7" };
+	for (int i = 0; i < n; ++i) {
+		size_t hash = i;
+		m->mw_map[hash] = {[] { return nullptr; }, PathPattern::make(patterns[i % std::size(patterns)]), {}, i};
+		m->mw_list.push_back(hash);
+	}
+	std::vector<std::string> path {"api", "v0", "res1", "7"};
+	std::vector<std::pair<size_t, ServerState::MiddlewareConfig *>> mw_list;
+	for (auto _ : state) {
+		mw_list.clear();
+		resolve_middlewares(*m, path, mw_list);
+		benchmark::DoNotOptimize(mw_list.data());
+	}
+}
+BENCHMARK(BM_ResolveMiddlewares)->RangeMultiplier(4)->Range(1, 256);
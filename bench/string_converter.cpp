@@ -0,0 +1,57 @@
+#include "bench.hpp"
+
+using namespace woof;
+
+template<class T>
+static void
+convert_loop(benchmark::State &state, const char *input)
+{
+	std::string s = input;
+	T val;
+	state.SetLabel(s);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(StringConverter<T>::convert(val, s));
+		benchmark::DoNotOptimize(val);
+	}
+}
+
+static void BM_StringConverterInt(benchmark::State &state, const char *s)       { convert_loop<int>(state, s); }
+static void BM_StringConverterLongLong(benchmark::State &state, const char *s)  { convert_loop<long long>(state, s); }
+static void BM_StringConverterUnsigned(benchmark::State &state, const char *s)  { convert_loop<unsigned long>(state, s); }
+static void BM_StringConverterDouble(benchmark::State &state, const char *s)    { convert_loop<double>(state, s); }
+static void BM_StringConverterBool(benchmark::State &state, const char *s)      { convert_loop<bool>(state, s); }
+
+BENCHMARK_CAPTURE(BM_StringConverterInt, valid, "123456");
+BENCHMARK_CAPTURE(BM_StringConverterInt, invalid, "12x");
+BENCHMARK_CAPTURE(BM_StringConverterLongLong, min, "-9223372036854775807");
+BENCHMARK_CAPTURE(BM_StringConverterUnsigned, max, "18446744073709551615");
+BENCHMARK_CAPTURE(BM_StringConverterDouble, pi, "3.14159265358979");
+BENCHMARK_CAPTURE(BM_StringConverterBool, true, "true");
+BENCHMARK_CAPTURE(BM_StringConverterBool, no, "no");
+
+struct SearchParams {
+	std::string q;
+	int page = 1;
+	std::optional<unsigned> limit;
+	std::vector<std::string> tag;
+	bool exact = false;
+	
+	using fields = FormFields<
+		FormField<"q", &SearchParams::q>,
+		FormField<"page", &SearchParams::page, false>,
+		FormField<"limit", &SearchParams::limit>,
+		FormField<"tag", &SearchParams::tag>,
+		FormField<"exact", &SearchParams::exact, false>
+	>;
+};
+
+static void
+BM_BindForm(benchmark::State &state)
+{
+	std::string_view query = "q=hello+world&page=3&limit=50&tag=a&tag=b&exact=1&utm_source=x";
+	for (auto _ : state) {
+		auto result = bind_form<SearchParams>(query);
+		benchmark::DoNotOptimize(result);
+	}
+}
+BENCHMARK(BM_BindForm);
@@ -37,7 +37,7 @@ struct MW2 : public woof::MiddlewareI {
 	}
 };
 
-// TODO: parsing multipart form data (bleh) et POST query params from body (ez)
+// TODO: POST query params from body (ez)
 // TODO: configurability -- req size limits, a Server: header
 // TODO: auto insert version into code with cmake
 
@@ -45,10 +45,13 @@ int
 main()
 {
 	woof::Server srv;
+	woof::AsyncLogger logger;
+	srv.logger(logger);
+	srv.access_log(logger);
 	
 	srv.GET<"/hello/{lang}">(
 		[](woof::Request &req, woof::Response &resp) {
-			const std::string &lang = req.path()["lang"];
+			std::string_view lang = req.path()["lang"];
 			
 			if      (lang == "en") resp.body() << "Hello";
 			else if (lang == "fr") resp.body() << "Salut";
@@ -68,12 +71,29 @@ main()
 		}
 	);
 	
+	srv.GET<"/add/{a:int}/{b:int}">(
+		[](woof::Request &, woof::Response &resp, int a, int b) {
+			resp.body() << a + b << '\n';
+		}
+	);
+	
 	srv.GET<"/hello/**">(
 		[](woof::Request &req, woof::Response &resp) {
 			resp.body() << req.target_string_raw() << '\n';
 		}
 	);
 	
+	srv.multipart({.memory_threshold = 1 << 20}, "/upload");
+	srv.POST<"/upload">(
+		[](woof::Request &req, woof::Response &resp) {
+			for (auto &part : req.parts()) {
+				resp.body() << part.name() << ": " << part.size() << " bytes";
+				if (!part.filename().empty()) resp.body() << " from " << part.filename();
+				resp.body() << (part.in_memory() ? "" : " (on disk)") << '\n';
+			}
+		}
+	);
+	
 	srv.add_middleware<MyMiddleware, "/hello/*">();
 	srv.add_middleware<MW2, "/**">();
 	
@@ -0,0 +1,380 @@
+/*
+	On-demand JSON parsing and streaming serialization.
+	This file is included inside namespace woof in <woof/woof.hpp>
+	
+	A JsonValue is a position in the document, nothing is parsed until it's asked for. Looking up a
+	key or an index skips over the values before it without looking inside them, 16 bytes at a time
+	with SSE2. Only what's accessed is checked, so a malformed value that's skipped isn't noticed.
+	Malformed JSON throws JsonError, and so do missing keys and values of the wrong type when they're
+	asked for with get() or operator[].
+	
+	Types are converted with JsonConverter. Structs that describe their fields with a `fields` member
+	type (see bind_form) are converted to and from objects.
+*/
+
+// A handler that lets it through responds with `status`
+class JsonError : public std::runtime_error {
+public:
+	Status status;
+	
+	JsonError(const std::string &what, Status status_ = 400) : std::runtime_error(what), status(status_) {}
+};
+
+enum class JsonType { NIL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+class JsonValue {
+	const char *p = nullptr; // The first byte of the value
+	const char *end = nullptr; // The end of the document
+	
+	JsonValue(const char *p_, const char *end_) noexcept : p(p_), end(end_) {}
+	
+public:
+	
+	JsonValue() noexcept = default;
+	// The document has to outlive the value
+	explicit JsonValue(std::string_view document);
+	
+	JsonType type() const;
+	bool is_null() const { return type() == JsonType::NIL; }
+	
+	// The text of the value, found by skipping over it
+	std::string_view raw() const;
+	
+	// The string without the quotes. Only decodes into buf if there are escapes, otherwise the view
+	// is into the document.
+	std::string_view string(std::string &buf) const;
+	std::string string() const;
+	
+	// The number's text, checked against the JSON grammar
+	std::string_view number() const;
+	
+	bool boolean() const;
+	
+	// Object members. Keys are compared after decoding their escapes.
+	std::optional<JsonValue> find(std::string_view key) const;
+	JsonValue operator[](std::string_view key) const;
+	
+	// Array elements, found by skipping the ones before
+	JsonValue operator[](size_t idx) const;
+	
+	// Elements of an array, or members of an object
+	size_t size() const;
+	
+	// Calls f(JsonValue) for each element of an array
+	template<class F>
+	void
+	for_each(F &&f) const
+	{
+		const char *q = begin_container('[');
+		while (q) {
+			JsonValue element(q, end);
+			f(element);
+			q = next_element(q, ']');
+		}
+	}
+	
+	// Calls f(std::string_view key, JsonValue) for each member of an object. The key is raw, with
+	// any escapes in it.
+	template<class F>
+	void
+	for_each_member(F &&f) const
+	{
+		const char *q = begin_container('{');
+		while (q) {
+			std::string_view key;
+			const char *value = member_value(q, key);
+			f(key, JsonValue(value, end));
+			q = next_element(value, '}');
+		}
+	}
+	
+	// Converts with JsonConverter<T>, throws JsonError if the value doesn't fit T
+	template<class T>
+	T
+	get() const;
+	
+private:
+	
+	// The first element or member of a container, or nullptr if it's empty
+	const char *begin_container(char open) const;
+	// Skips the value at q, and the comma after it. Returns nullptr at the closing bracket.
+	const char *next_element(const char *q, char close) const;
+	// Reads the key at q, returns the value after the colon
+	const char *member_value(const char *q, std::string_view &key) const;
+}; // class JsonValue
+
+// Writes JSON text straight into a stream buffer, like the response body's. It doesn't check that
+// the calls make a well-formed document.
+class JsonWriter {
+	std::streambuf *out;
+	bool first = true; // No comma before the next value
+	
+	void
+	separate()
+	{
+		if (!first) out->sputc(',');
+		first = false;
+	}
+	
+public:
+	
+	explicit JsonWriter(std::streambuf *out_) noexcept : out(out_) {}
+	explicit JsonWriter(std::ostream &out_) noexcept : out(out_.rdbuf()) {}
+	
+	JsonWriter &begin_object() { separate(); out->sputc('{'); first = true; return *this; }
+	JsonWriter &end_object()   { out->sputc('}'); first = false; return *this; }
+	JsonWriter &begin_array()  { separate(); out->sputc('['); first = true; return *this; }
+	JsonWriter &end_array()    { out->sputc(']'); first = false; return *this; }
+	
+	// The next value is this member's
+	JsonWriter &
+	key(std::string_view name)
+	{
+		separate();
+		write_string(name);
+		out->sputc(':');
+		first = true;
+		return *this;
+	}
+	
+	JsonWriter &null()                  { separate(); out->sputn("null", 4); return *this; }
+	JsonWriter &boolean(bool b)         { separate(); b ? out->sputn("true", 4) : out->sputn("false", 5); return *this; }
+	JsonWriter &string(std::string_view s) { separate(); write_string(s); return *this; }
+	// Text that's already JSON, like JsonValue::raw()
+	JsonWriter &raw(std::string_view json) { separate(); out->sputn(json.data(), json.size()); return *this; }
+	
+	template<class T>
+	JsonWriter &
+	number(T x)
+	{
+		separate();
+		if constexpr (std::is_floating_point_v<T>) {
+			// JSON has no infinities or NaN
+			if (!std::isfinite(x)) {
+				out->sputn("null", 4);
+				return *this;
+			}
+		}
+		char buf[32];
+		auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), x);
+		out->sputn(buf, ptr - buf);
+		return *this;
+	}
+	
+	// Converts with JsonConverter<T>
+	template<class T>
+	JsonWriter &
+	value(const T &x);
+	
+	template<class T>
+	JsonWriter &
+	member(std::string_view name, const T &x)
+	{ return key(name).value(x); }
+	
+private:
+	
+	void write_string(std::string_view s);
+}; // class JsonWriter
+
+// read() returns false if the value doesn't fit T, write() writes it
+template<class T>
+struct JsonConverter;
+
+template<class T>
+T
+JsonValue::get() const
+{
+	T x {};
+	if (!JsonConverter<T>::read(x, *this)) throw JsonError("Unexpected JSON value: " + std::string(raw().substr(0, 64)));
+	return x;
+}
+
+template<class T>
+JsonWriter &
+JsonWriter::value(const T &x)
+{
+	JsonConverter<T>::write(*this, x);
+	return *this;
+}
+
+template<>
+struct JsonConverter<bool> {
+	static bool read(bool &x, JsonValue v) {
+		if (v.type() != JsonType::BOOLEAN) return false;
+		x = v.boolean();
+		return true;
+	}
+	static void write(JsonWriter &w, bool x) { w.boolean(x); }
+};
+
+template<class T>
+requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+struct JsonConverter<T> {
+	static bool read(T &x, JsonValue v) {
+		if (v.type() != JsonType::NUMBER) return false;
+		std::string_view s = v.number();
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+		return ec == std::errc() && ptr == s.data() + s.size();
+	}
+	static void write(JsonWriter &w, T x) { w.number(x); }
+};
+
+template<>
+struct JsonConverter<std::string> {
+	static bool read(std::string &x, JsonValue v) {
+		if (v.type() != JsonType::STRING) return false;
+		x = v.string();
+		return true;
+	}
+	static void write(JsonWriter &w, const std::string &x) { w.string(x); }
+};
+
+template<>
+struct JsonConverter<std::string_view> {
+	static void write(JsonWriter &w, std::string_view x) { w.string(x); }
+};
+
+template<>
+struct JsonConverter<const char *> {
+	static void write(JsonWriter &w, const char *x) { w.string(x); }
+};
+
+template<size_t N>
+struct JsonConverter<char[N]> {
+	static void write(JsonWriter &w, const char *x) { w.string(x); }
+};
+
+template<>
+struct JsonConverter<JsonValue> {
+	static bool read(JsonValue &x, JsonValue v) { x = v; return true; }
+	static void write(JsonWriter &w, JsonValue x) { w.raw(x.raw()); }
+};
+
+template<class T>
+struct JsonConverter<std::optional<T>> {
+	static bool read(std::optional<T> &x, JsonValue v) {
+		if (v.is_null()) {
+			x.reset();
+			return true;
+		}
+		T val {};
+		if (!JsonConverter<T>::read(val, v)) return false;
+		x = std::move(val);
+		return true;
+	}
+	static void write(JsonWriter &w, const std::optional<T> &x) {
+		if (x) w.value(*x);
+		else w.null();
+	}
+};
+
+template<class T>
+struct JsonConverter<std::vector<T>> {
+	static bool read(std::vector<T> &x, JsonValue v) {
+		if (v.type() != JsonType::ARRAY) return false;
+		bool ok = true;
+		x.clear();
+		v.for_each([&](JsonValue element) {
+			if (!ok) return;
+			ok = JsonConverter<T>::read(x.emplace_back(), element);
+		});
+		return ok;
+	}
+	static void write(JsonWriter &w, const std::vector<T> &x) {
+		w.begin_array();
+		for (auto &element : x) w.value(element);
+		w.end_array();
+	}
+};
+
+template<class T>
+struct JsonConverter<std::map<std::string, T>> {
+	static bool read(std::map<std::string, T> &x, JsonValue v) {
+		if (v.type() != JsonType::OBJECT) return false;
+		bool ok = true;
+		x.clear();
+		std::string buf;
+		v.for_each_member([&](std::string_view key, JsonValue value) {
+			if (!ok) return;
+			ok = JsonConverter<T>::read(x[std::string(JsonValue(key).string(buf))], value);
+		});
+		return ok;
+	}
+	static void write(JsonWriter &w, const std::map<std::string, T> &x) {
+		w.begin_object();
+		for (auto &[key, value] : x) w.member(key, value);
+		w.end_object();
+	}
+};
+
+template<class T, class... Fields>
+BindResult<T>
+_bind_json(JsonValue v, FormFields<Fields...>)
+{
+	constexpr size_t N = sizeof...(Fields);
+	BindResult<T> result;
+	if (v.type() != JsonType::OBJECT) throw JsonError("Expected a JSON object");
+	std::array<bool, N> seen {};
+	std::array<bool, N> bad {};
+	std::string key_buf;
+	
+	v.for_each_member([&](std::string_view raw_key, JsonValue value) {
+		std::string_view key = JsonValue(raw_key).string(key_buf);
+		[&]<size_t... I>(std::index_sequence<I...>) {
+			(... || [&] {
+				using F = std::tuple_element_t<I, std::tuple<Fields...>>;
+				if (key != F::name) return false;
+				auto &member = F::get(result.value);
+				using M = std::remove_reference_t<decltype(member)>;
+				seen[I] = true;
+				bad[I] = !JsonConverter<M>::read(member, value);
+				return true;
+			}());
+		}(std::index_sequence_for<Fields...>());
+	});
+	
+	[&]<size_t... I>(std::index_sequence<I...>) {
+		([&] {
+			using F = std::tuple_element_t<I, std::tuple<Fields...>>;
+			using M = std::remove_reference_t<decltype(F::get(result.value))>;
+			if (bad[I]) {
+				result.invalid.push_back(F::name);
+			} else if (!seen[I] && F::is_required && !_form_member<M>::optional) {
+				result.missing.push_back(F::name);
+			}
+		}(), ...);
+	}(std::index_sequence_for<Fields...>());
+	
+	return result;
+}
+
+// Binds a JSON object to a struct described by a `fields` member type, the same as for bind_form.
+// Values are converted with JsonConverter, so members can be nested structs, vectors and optionals.
+// All the missing and invalid fields are reported at once. Unknown keys are ignored.
+template<class T>
+BindResult<T>
+bind_json(JsonValue v)
+{ return _bind_json<T>(v, typename T::fields()); }
+
+template<class T>
+requires requires { typename T::fields; }
+struct JsonConverter<T> {
+	static bool read(T &x, JsonValue v) {
+		if (v.type() != JsonType::OBJECT) return false;
+		auto result = bind_json<T>(v);
+		if (!result) return false;
+		x = std::move(result.value);
+		return true;
+	}
+	
+	template<class... Fields>
+	static void
+	write_fields(JsonWriter &w, const T &x, FormFields<Fields...>)
+	{
+		w.begin_object();
+		(w.member(Fields::name, Fields::get(x)), ...);
+		w.end_object();
+	}
+	
+	static void write(JsonWriter &w, const T &x) { write_fields(w, x, typename T::fields()); }
+};
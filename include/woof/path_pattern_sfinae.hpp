@@ -31,7 +31,7 @@ dumpbuf(bool wildcard) -- push a segment with the name being the buffer, and cle
 
 	STATE_IN_NAME:
 		'\0' => error
-		'}' => dumpbuf(true), state STATE_RBRACE, next
+		'}' => dumpbuf(true) (split into name:type), state STATE_RBRACE, next
 		else => append, next
 
 	STATE_RBRACE:
@@ -87,6 +87,14 @@ Push(auto &pp) noexcept
 	pp.segments.push_back({wildcard, {buf...}});
 }
 
+template<char... buf>
+inline constexpr void
+PushParam(auto &pp) noexcept
+{
+	constexpr char spec[] = {buf...};
+	pp.segments.push_back(PathPattern::Segment::param({spec, sizeof(spec)}));
+}
+
 // state SLASH
 
 template<Data data>
@@ -183,7 +191,7 @@ struct Do<data, State::IN_NAME, '\0', buf...> {
 template<Data data, char... buf>
 struct Do<data, State::IN_NAME, '}', buf...> {
 	static constexpr void path(auto &pp) noexcept {
-		Push<true, buf...>(pp);
+		PushParam<buf...>(pp);
 		Next<data, State::RBRACE>::path(pp);
 	}
 };
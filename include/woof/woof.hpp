@@ -1,14 +1,24 @@
 #ifndef _WOOF_woof_woof_hpp
 #define _WOOF_woof_woof_hpp
 
+#include <algorithm>
+#include <array>
 #include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <functional>
 #include <istream>
 #include <limits>
+#include <map>
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <stdexcept>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
@@ -27,17 +37,112 @@ constexpr const char VERSION[] = "0.1.0";
 
 enum class LogLevel { TRACE, DEBUG, INFO, WARN, ERROR, CRITICAL };
 enum class Method { UNKNOWN, GET, HEAD, POST, PUT, DELETE, CONNECT, OPTIONS, TRACE, PATCH };
+enum class LogOverflow { DROP, BLOCK };
 
+// Well-known header fields with O(1) access through Request::header and Response::header. Other
+// headers are only available through the header maps.
+enum class Field {
+	UNKNOWN,
+	ACCEPT,
+	ACCEPT_CHARSET,
+	ACCEPT_ENCODING,
+	ACCEPT_LANGUAGE,
+	ACCEPT_RANGES,
+	ACCESS_CONTROL_ALLOW_CREDENTIALS,
+	ACCESS_CONTROL_ALLOW_HEADERS,
+	ACCESS_CONTROL_ALLOW_METHODS,
+	ACCESS_CONTROL_ALLOW_ORIGIN,
+	ACCESS_CONTROL_EXPOSE_HEADERS,
+	ACCESS_CONTROL_MAX_AGE,
+	ACCESS_CONTROL_REQUEST_HEADERS,
+	ACCESS_CONTROL_REQUEST_METHOD,
+	AGE,
+	ALLOW,
+	AUTHORIZATION,
+	CACHE_CONTROL,
+	CONNECTION,
+	CONTENT_DISPOSITION,
+	CONTENT_ENCODING,
+	CONTENT_LANGUAGE,
+	CONTENT_LENGTH,
+	CONTENT_LOCATION,
+	CONTENT_RANGE,
+	CONTENT_TYPE,
+	COOKIE,
+	DATE,
+	ETAG,
+	EXPECT,
+	EXPIRES,
+	FORWARDED,
+	FROM,
+	HOST,
+	IF_MATCH,
+	IF_MODIFIED_SINCE,
+	IF_NONE_MATCH,
+	IF_RANGE,
+	IF_UNMODIFIED_SINCE,
+	KEEP_ALIVE,
+	LAST_MODIFIED,
+	LINK,
+	LOCATION,
+	ORIGIN,
+	PRAGMA,
+	PROXY_AUTHORIZATION,
+	RANGE,
+	REFERER,
+	RETRY_AFTER,
+	SERVER,
+	SET_COOKIE,
+	TE,
+	TRAILER,
+	TRANSFER_ENCODING,
+	UPGRADE,
+	USER_AGENT,
+	VARY,
+	VIA,
+	WWW_AUTHENTICATE,
+	COUNT
+};
+
+class AsyncLogState;
 class ConnectionState;
 class MiddlewareI;
 class Request;
 class Response;
+class JsonValue;
+class JsonWriter;
+class ResponseCacheState;
+class RateLimiterState;
+class ConcurrencyLimiterState;
+class WebSocketState;
+class WebSocketHubState;
+class EventChannelState;
+class TlsState;
 class Server;
 class ServerState;
 
 template<class T>
 struct StringConverter;
 
+// Converters take a std::string_view. Ones written for a const std::string & still work, they get a
+// copy.
+template<class Converter, class T>
+bool
+_string_convert(T &x, std::string_view s)
+{
+	if constexpr (requires { Converter::convert(x, s); }) {
+		return Converter::convert(x, s);
+	} else {
+		return Converter::convert(x, std::string(s));
+	}
+}
+
+template<class T>
+struct BindResult;
+
+template<class T>
+BindResult<T> bind_form(std::string_view s);
+
 using LogHandler = std::function<void(LogLevel, const char *, size_t)>;
 using RequestHandler = std::function<void(Request &, Response &)>;
 using MiddlewareCreator = std::function<MiddlewareI *()>;
@@ -49,12 +154,16 @@ public:
 	virtual void after(Request &, Response &) = 0;
 };
 
+// Both are transparent, so a HeaderMap can be searched with a string_view or a string literal
+// without building a std::string first
 struct CaseInsensitiveHash {
-	size_t operator()(const std::string &s) const;
+	using is_transparent = void;
+	size_t operator()(std::string_view s) const noexcept;
 };
 
 struct CaseInsensitiveEquals {
-	bool operator()(const std::string &a, const std::string &b) const;
+	using is_transparent = void;
+	bool operator()(std::string_view a, std::string_view b) const noexcept;
 };
 
 using HeaderMap = std::unordered_multimap<std::string, std::string, CaseInsensitiveHash, CaseInsensitiveEquals>;
@@ -105,6 +214,78 @@ struct StringConstant {
 	}
 };
 
+// FNV-1a, so that param names given as template arguments are hashed at compile time
+constexpr uint64_t
+param_hash(std::string_view s) noexcept
+{
+	uint64_t h = 0xcbf29ce484222325;
+	for (char c : s) {
+		h = (h ^ uint8_t(c)) * 0x100000001b3;
+	}
+	return h;
+}
+
+// Types of path params declared as {name:type}. A route only matches if all of its typed params
+// convert, and endpoint handlers can take the converted values as extra arguments.
+enum class ParamType { STRING, INT, I32, I64, U32, U64, F32, F64 };
+
+constexpr bool
+parse_param_type(std::string_view s, ParamType &type) noexcept
+{
+	if      (s == "str") type = ParamType::STRING;
+	else if (s == "int") type = ParamType::INT;
+	else if (s == "i32") type = ParamType::I32;
+	else if (s == "i64") type = ParamType::I64;
+	else if (s == "u32") type = ParamType::U32;
+	else if (s == "u64") type = ParamType::U64;
+	else if (s == "f32") type = ParamType::F32;
+	else if (s == "f64") type = ParamType::F64;
+	else return false;
+	return true;
+}
+
+template<ParamType> struct ParamTypeOf;
+template<> struct ParamTypeOf<ParamType::STRING> { using type = std::string_view; };
+template<> struct ParamTypeOf<ParamType::INT>    { using type = int; };
+template<> struct ParamTypeOf<ParamType::I32>    { using type = int32_t; };
+template<> struct ParamTypeOf<ParamType::I64>    { using type = int64_t; };
+template<> struct ParamTypeOf<ParamType::U32>    { using type = uint32_t; };
+template<> struct ParamTypeOf<ParamType::U64>    { using type = uint64_t; };
+template<> struct ParamTypeOf<ParamType::F32>    { using type = float; };
+template<> struct ParamTypeOf<ParamType::F64>    { using type = double; };
+
+// A converted typed path param, which member is set depends on the ParamType
+union ParamValue {
+	int64_t i;
+	uint64_t u;
+	double f;
+};
+
+// Scans the params of a pattern without parsing it, for the typed handler arguments. Params are the
+// wildcards that have a name or a type other than str. Returns the number of params, or -1 on an
+// unknown type.
+constexpr int
+scan_param_types(std::string_view pattern, ParamType *types = nullptr) noexcept
+{
+	int n = 0;
+	for (size_t i = 0; i < pattern.size(); ++i) {
+		if (pattern[i] != '{') continue;
+		size_t end = pattern.find('}', i);
+		if (end == std::string_view::npos) return n;
+		std::string_view spec = pattern.substr(i + 1, end - i - 1);
+		ParamType type = ParamType::STRING;
+		size_t colon = spec.find(':');
+		if (colon != std::string_view::npos && !parse_param_type(spec.substr(colon + 1), type)) return -1;
+		// The same rule as the router's, so that "{:str}" isn't a param either
+		if (!spec.substr(0, colon).empty() || type != ParamType::STRING) {
+			if (types) types[n] = type;
+			++n;
+		}
+		i = end;
+	}
+	return n;
+}
+
 template<StringConstant sc, size_t idx>
 struct _path;
 
@@ -112,6 +293,10 @@ struct PathPattern {
 	struct Segment {
 		bool wildcard;
 		std::string name;
+		ParamType type = ParamType::STRING;
+		
+		// Makes a wildcard segment out of what's between the braces, "name" or "name:type"
+		static Segment param(std::string_view spec);
 	};
 	
 	std::vector<Segment> segments {};
@@ -123,6 +308,7 @@ struct PathPattern {
 	static constexpr PathPattern
 	make() noexcept
 	{
+		static_assert(scan_param_types(pattern.chars) >= 0, "Unknown path param type");
 		PathPattern pp;
 		_path<pattern, pattern.chars[0] == '/'>::path(pp);
 		return pp;
@@ -218,6 +404,45 @@ namespace status {
 	inline constexpr Status NETWORK_AUTHENTICATION_REQUIRED = 511;
 } // namespace status
 
+// A part of a multipart/form-data request body, see Server::multipart. A part that's bigger than
+// the config's memory_threshold is in a temporary file, which is removed with the part.
+class MultipartPart {
+	friend class MultipartParser;
+	HeaderMap m_headers;
+	std::string m_name;
+	std::string m_filename;
+	std::string m_data;
+	std::string m_path;
+	bool m_temporary = false; // Remove m_path with the part
+	size_t m_size = 0;
+public:
+	
+	MultipartPart() = default;
+	MultipartPart(MultipartPart &&other) noexcept;
+	MultipartPart &operator=(MultipartPart &&other) noexcept;
+	~MultipartPart();
+	
+	const HeaderMap &headers() const { return m_headers; }
+	// From Content-Disposition. The filename is empty if the part isn't a file.
+	const std::string &name() const { return m_name; }
+	const std::string &filename() const { return m_filename; }
+	// text/plain if the part doesn't say
+	std::string_view content_type() const;
+	size_t size() const { return m_size; }
+	
+	bool in_memory() const { return m_path.empty(); }
+	// The content, if it's in memory
+	const std::string &data() const { return m_data; }
+	// The file with the content, if it's not
+	const std::string &path() const { return m_path; }
+	// Reads the content, wherever it is
+	std::unique_ptr<std::istream> stream() const;
+	
+	// Moves the content to a file, which is then kept. A temporary file is renamed if it can be.
+	// Throws std::filesystem::filesystem_error if it can't be saved, and the part is left as it was.
+	void save(const std::string &path);
+}; // class MultipartPart
+
 class Request {
 	friend Server;
 	std::shared_ptr<ConnectionState> m;
@@ -229,26 +454,59 @@ public:
 		std::shared_ptr<ConnectionState> m;
 	public:
 		
-		std::unordered_map<std::string, std::string> &map();
-		const std::unordered_map<std::string, std::string> &map() const;
-		
 		const std::string &string() const;
 		const std::string &string_raw() const;
 		
-		std::string &
-		operator[](const std::string &key)
-		{ return map().at(key); }
+		// Params are numbered in the order they appear in the pattern. The views stay valid until
+		// the response is sent.
+		size_t size() const;
+		std::string_view name(size_t idx) const;
+		std::string_view operator[](size_t idx) const;
 		
-		const std::string &
-		operator[](const std::string &key) const
-		{ return map().at(key); }
+		// Throws std::out_of_range if there's no param with that name
+		std::string_view operator[](std::string_view key) const;
+		
+		// A copy of the params, for code written when they were kept in a map
+		[[deprecated("Use operator[], name() and size()")]]
+		std::unordered_map<std::string, std::string> map() const;
+		
+		// The value of a typed param of the endpoint, as converted when routing
+		ParamValue value(size_t idx) const;
+		
+		template<ParamType type>
+		typename ParamTypeOf<type>::type
+		typed(size_t idx) const
+		{
+			using T = typename ParamTypeOf<type>::type;
+			if constexpr (type == ParamType::STRING) {
+				return this->operator[](idx);
+			} else if constexpr (std::is_floating_point_v<T>) {
+				return T(value(idx).f);
+			} else if constexpr (std::is_signed_v<T>) {
+				return T(value(idx).i);
+			} else {
+				return T(value(idx).u);
+			}
+		}
 		
 		template<class T, class Converter = StringConverter<T>>
 		std::optional<T>
-		get(const std::string &key) const
+		get(size_t idx) const
 		{
 			T val;
-			if (Converter::convert(val, this->operator[](key))) {
+			if (_string_convert<Converter>(val, this->operator[](idx))) {
+				return {val};
+			} else {
+				return {};
+			}
+		}
+		
+		template<class T, class Converter = StringConverter<T>>
+		std::optional<T>
+		get(std::string_view key) const
+		{
+			T val;
+			if (_string_convert<Converter>(val, this->operator[](key))) {
 				return {val};
 			} else {
 				return {};
@@ -257,16 +515,46 @@ public:
 		
 		template<class T, class Converter = StringConverter<T>>
 		T
-		get_or(const std::string &key, T default_value = T()) const
+		get_or(std::string_view key, T default_value = T()) const
 		{
 			T val;
-			if (Converter::convert(val, this->operator[](key))) {
+			if (_string_convert<Converter>(val, this->operator[](key))) {
 				return val;
 			} else {
 				return default_value;
 			}
 		}
 		
+		// The name is hashed at compile time, the lookup only compares hashes of the route's params
+		template<StringConstant key, class T, class Converter = StringConverter<T>>
+		std::optional<T>
+		get() const
+		{
+			T val;
+			std::optional<std::string_view> sv = find(param_hash(key.chars), key.chars);
+			if (sv && _string_convert<Converter>(val, *sv)) {
+				return {val};
+			} else {
+				return {};
+			}
+		}
+		
+		template<StringConstant key, class T, class Converter = StringConverter<T>>
+		T
+		get_or(T default_value = T()) const
+		{
+			T val;
+			std::optional<std::string_view> sv = find(param_hash(key.chars), key.chars);
+			if (sv && _string_convert<Converter>(val, *sv)) {
+				return val;
+			} else {
+				return default_value;
+			}
+		}
+		
+	private:
+		
+		std::optional<std::string_view> find(uint64_t hash, std::string_view key) const;
 	}; // class Request::Path
 	
 	class Query {
@@ -347,6 +635,13 @@ public:
 			}
 		}
 		
+		// Parses and converts all the fields of T described by T::fields in one pass over the raw
+		// query string. See bind_form.
+		template<class T>
+		BindResult<T>
+		bind() const
+		{ return bind_form<T>(string_raw()); }
+		
 	}; // class Request::Query
 	
 	class Body {
@@ -388,6 +683,10 @@ public:
 	
 	Method method() const;
 	
+	// Empty and 0 if the connection isn't over IP
+	std::string remote_address() const;
+	int remote_port() const;
+	
 	const std::string &target_string() const;
 	const std::string &target_string_raw() const;
 	
@@ -397,12 +696,31 @@ public:
 	Query &query() { return m_query; }
 	const Query &query() const { return m_query; }
 	
+	// Changing the headers through the mutable one is fine, but the next header() call then has to
+	// go over them again. The mutators below don't have that cost.
 	HeaderMap &headers();
 	const HeaderMap &headers() const;
 	
+	// Null if the header isn't present. Multiple values are only accessible through headers().
+	const std::string *header(Field field) const;
+	
+	// Changes to the request headers, which header() sees. set_header replaces all the values.
+	void add_header(std::string_view name, std::string value);
+	void set_header(std::string_view name, std::string value);
+	void remove_header(std::string_view name);
+	
 	Body &body() { return m_body; }
 	const Body &body() const { return m_body; }
 	
+	// The body as JSON, parsed on demand, see JsonValue. It's a view of the body, which it can't
+	// outlive. Throws JsonError with 415 if the Content-Type is there and isn't JSON.
+	JsonValue json() const;
+	
+	// The parts of a multipart/form-data body, if Server::multipart applies to the request. Empty
+	// otherwise, the body is then in body().
+	std::vector<MultipartPart> &parts();
+	const std::vector<MultipartPart> &parts() const;
+	
 	Request(const Request &) noexcept = default;
 	Request(std::shared_ptr<ConnectionState> m_ = {}) noexcept
 	{
@@ -453,9 +771,20 @@ public:
 	HeaderMap &headers();
 	const HeaderMap &headers() const;
 	
+	// Headers set this way replace any header of the same name already in headers()
+	const std::string *header(Field field) const;
+	void header(Field field, std::string value);
+	
 	Body &body() { return m_body; }
 	const Body &body() const { return m_body; }
 	
+	// Sets Content-Type to application/json, and returns a writer into the body
+	JsonWriter json_writer();
+	
+	// Serializes x into the body with JsonConverter, see json_writer()
+	template<class T>
+	void json(const T &x);
+	
 	Response(const Response &) noexcept = default;
 	Response(std::shared_ptr<ConnectionState> m_ = {}) noexcept
 	{
@@ -467,6 +796,233 @@ private:
 	Body m_body;
 }; // class Response
 
+// Logs from the calling threads into per-thread lock-free ring buffers, which a background thread
+// drains, formats and hands to the sink in batches. Copies share the same backend, which is shut
+// down (and flushed) when the last copy goes away. Messages from different threads are not
+// guaranteed to be delivered in the order they were logged.
+class AsyncLogger {
+	std::shared_ptr<AsyncLogState> m;
+public:
+	
+	// The sink is only ever called from the background thread. Without one, messages are written to
+	// stdout, one write per batch. The capacity is in slots of a single ring, rounded up to a power
+	// of two; a slot fits about 240 bytes of a message.
+	AsyncLogger(size_t capacity = 1024, LogOverflow overflow = LogOverflow::DROP, const LogHandler &sink = {});
+	
+	AsyncLogger &flush_interval(std::chrono::milliseconds interval);
+	
+	void operator()(LogLevel level, const char *str, size_t len) const;
+	
+	void access(Method method, std::string_view target, int status, uint64_t bytes, std::chrono::nanoseconds latency) const;
+	
+	void flush() const;
+	uint64_t dropped() const;
+}; // class AsyncLogger
+
+// An in-memory cache of whole responses to GET and HEAD requests, see Server::cache. Entries are keyed
+// on the method, the decoded target and the values of the vary() headers. They're stored already
+// serialized, so a hit is written right after routing, without running the middlewares or the
+// handler. A response is only stored if its status is cacheable by default and it has a
+// Cache-Control max-age or s-maxage, or there's a default TTL. no-store, no-cache, private, a
+// Set-Cookie header or Vary: * keep it out of the cache. A request with an Authorization header is
+// never served from the cache, and its response is only stored if it's public, must-revalidate or
+// has an s-maxage. A request's own no-cache skips the lookup, and no-store skips storing as well.
+//
+// The entries are spread over shards by the hash of their key, each with its own lock and its own
+// share of the memory budget, and are evicted least recently used first. Copies share the same
+// cache. It must be configured before the server starts.
+class ResponseCache {
+	friend Server;
+	std::shared_ptr<ResponseCacheState> m;
+public:
+	
+	ResponseCache(size_t max_bytes = 64 << 20, size_t nshards = 16);
+	
+	ResponseCache &vary(const std::string &header);
+	ResponseCache &default_ttl(std::chrono::seconds ttl);
+	
+	void clear() const;
+	size_t size() const;
+	size_t bytes() const;
+	uint64_t hits() const;
+	uint64_t misses() const;
+}; // class ResponseCache
+
+// Token buckets per client, see Server::rate_limit. Each client gets `burst` tokens to start with,
+// refilled at `rate` per second, and every request takes one. Clients are told apart by their
+// address, or by the value of a header, e.g. when behind a proxy. The buckets live in a lock-free
+// open-addressed table of fixed capacity, and are only refilled when they're used. A bucket that
+// would be full again holds no information, so it's reused for other clients. That takes the place
+// of sharding and of evicting in the background, with a trade-off: a client only looks at the 16
+// buckets after the one its key hashes to, and if none of them is free or full again, because
+// `capacity` is too small for the number of active clients, its requests are let through.
+class RateLimiter {
+	friend Server;
+	std::shared_ptr<RateLimiterState> m;
+public:
+	
+	RateLimiter(double rate, double burst, size_t capacity = 1 << 16);
+	
+	// Requests without the header are keyed on their address
+	RateLimiter &key_header(const std::string &name);
+	
+	uint64_t limited() const;
+}; // class RateLimiter
+
+// An adaptive limit on the requests being handled at once, see Server::concurrency_limit. It follows
+// the latency of the handlers, like the gradient limiters of Netflix's concurrency-limits: while the
+// latency of recent requests stays close to its long-term average the limit grows, and as it rises
+// above it the limit shrinks in proportion.
+class ConcurrencyLimiter {
+	friend Server;
+	std::shared_ptr<ConcurrencyLimiterState> m;
+public:
+	
+	ConcurrencyLimiter(int initial = 20, int min = 1, int max = 1000);
+	
+	int limit() const;
+	int in_flight() const;
+	uint64_t rejected() const;
+}; // class ConcurrencyLimiter
+
+// A WebSocket connection, see Server::WS. Copies refer to the same connection, and can be used from
+// any thread.
+class WebSocket {
+	friend class WebSocketHub;
+	std::shared_ptr<WebSocketState> m;
+public:
+	
+	WebSocket(std::shared_ptr<WebSocketState> m_ = {}) noexcept : m(std::move(m_)) {}
+	
+	// The request that was upgraded, e.g. for its path params
+	Request &request() const;
+	
+	// Queues a message. If more than WebSocketHandlers::max_queued_bytes are waiting to be written
+	// already, it's dropped and false is returned. The shared_ptr overload sends the same buffer
+	// without copying it.
+	bool send(std::string_view message, bool binary = false) const;
+	bool send(std::shared_ptr<const std::string> message, bool binary = false) const;
+	
+	// Closes the connection once the queued messages are written
+	void close() const;
+	
+	bool operator==(const WebSocket &other) const noexcept { return m == other.m; }
+}; // class WebSocket
+
+// The callbacks are called on the workers, one at a time for each connection
+struct WebSocketHandlers {
+	std::function<void(WebSocket &)> on_open;
+	std::function<void(WebSocket &, std::string_view message, bool binary)> on_message;
+	std::function<void(WebSocket &)> on_close;
+	size_t max_message_bytes = 1 << 20;
+	size_t max_queued_bytes = 1 << 20;
+};
+
+// A set of WebSockets that receive the same messages. A broadcast message is stored once and every
+// subscriber's write queue refers to it. Subscribers that fall behind by more than their
+// max_queued_bytes are disconnected, and closed ones are dropped.
+class WebSocketHub {
+	std::shared_ptr<WebSocketHubState> m;
+public:
+	
+	WebSocketHub();
+	
+	void subscribe(const WebSocket &socket) const;
+	void unsubscribe(const WebSocket &socket) const;
+	void broadcast(std::string_view message, bool binary = false) const;
+	size_t size() const;
+}; // class WebSocketHub
+
+// Server-Sent Events, see Server::SSE. A published event is encoded once, and every subscriber's
+// write queue refers to the same buffer. The last `history` events are kept, so that a client that
+// reconnects with Last-Event-ID is sent the ones it missed. Idle subscribers are sent a comment every
+// `heartbeat`, and ones that fall behind by more than `max_queued_bytes` are disconnected.
+class EventChannel {
+	friend Server;
+	std::shared_ptr<EventChannelState> m;
+public:
+	
+	EventChannel(
+		size_t history = 64,
+		std::chrono::seconds heartbeat = std::chrono::seconds(15),
+		size_t max_queued_bytes = 1 << 20
+	);
+	
+	// Returns the event's id. `event` is the event type, "message" if empty.
+	uint64_t publish(std::string_view data, std::string_view event = {}) const;
+	size_t size() const;
+}; // class EventChannel
+
+// See Server::socket_options. Zero leaves the system default.
+struct SocketOptions {
+	int backlog = 0; // listen(), SOMAXCONN if zero
+	bool reuse_address = true;
+	// On TCP connections
+	bool no_delay = false;
+	int defer_accept = 0; // Seconds to wait for the request before accepting
+	int fastopen = 0; // Length of the TCP Fast Open queue
+	int receive_buffer = 0;
+	int send_buffer = 0;
+	bool keepalive = false;
+	int keepalive_idle = 0; // Seconds
+	int keepalive_interval = 0; // Seconds
+	int keepalive_count = 0;
+	// Hold partial segments with TCP_CORK while a response is written, so that its head and body go
+	// out together
+	bool cork = false;
+};
+
+// See Server::worker_affinity
+struct WorkerAffinity {
+	// Worker i runs on cpus[i % cpus.size()]
+	std::vector<int> cpus;
+	// Without cpus, lay the workers out from the topology: the physical cores of one NUMA node, then
+	// of the next, and hyper-threads last. Only CPUs the process is allowed to run on are used.
+	bool automatic = false;
+};
+
+// A response that's serialized once and written as is, see Server::add_fixed_response and
+// Server::error_response. An empty content_type leaves the field out.
+struct FixedResponse {
+	Status status = 200;
+	std::string body {};
+	std::string content_type = "text/plain; charset=utf-8";
+	std::vector<std::pair<std::string, std::string>> headers {};
+};
+
+// See Server::multipart. Going over a limit gives a 413.
+struct MultipartConfig {
+	size_t memory_threshold = 64 << 10; // Bigger parts go to a temporary file
+	size_t max_parts = 128;
+	size_t max_part_size = 64 << 20;
+	size_t max_size = 256 << 20; // Of the whole body
+	size_t max_header_size = 8 << 10; // Of each part's header
+	std::string temp_directory {}; // $TMPDIR or /tmp if empty
+};
+
+// See Server::connection_stats
+struct ConnectionStats {
+	size_t open;     // Counted towards the cap
+	size_t idle;     // Waiting for a request, either queued for a worker or reading the request head
+	uint64_t accepted;
+	uint64_t evicted;
+};
+
+// See Server::tls. The files are PEM.
+struct TlsConfig {
+	std::string certificate_chain_file;
+	std::string private_key_file;
+	// Offer HTTP/2 with ALPN, besides HTTP/1.1
+	bool http2 = true;
+	// Sessions kept by the server for resumption, for clients that don't use tickets
+	size_t session_cache_size = 20480;
+	std::chrono::seconds session_timeout = std::chrono::seconds(7200);
+	// Session tickets are encrypted with a key that changes this often. A ticket stays valid for one
+	// more period, and is then replaced. Zero disables tickets.
+	std::chrono::seconds ticket_key_rotation = std::chrono::seconds(3600);
+	std::chrono::seconds handshake_timeout = std::chrono::seconds(10);
+};
+
 class Server {
 	std::shared_ptr<ServerState> m;
 public:
@@ -476,6 +1032,35 @@ public:
 	Server &logger(const LogHandler &handler); //! The end user has to make sure it's thread safe
 	Server &address(const std::string &address);
 	Server &port(int port);
+	// Adds a TCP listener. Without any listeners, the server listens on address():port().
+	Server &listen(const std::string &address, int port);
+	// Adds a Unix domain socket listener. A socket file already at the path is replaced, and the new
+	// one gets the permissions. TLS only applies to TCP listeners.
+	Server &listen_unix(const std::string &path, unsigned permissions = 0660);
+	// Options for the listening sockets and the connections. Ones the system doesn't support, or
+	// that it rejects, are logged and skipped.
+	Server &socket_options(const SocketOptions &options);
+	// Pins each worker thread to a CPU. Memory a worker allocates is then local to its NUMA node. The
+	// placement is logged at startup. The thread calling run() then only waits for the workers.
+	Server &worker_affinity(const WorkerAffinity &affinity);
+	// Every response gets a Date field. With a value, it also gets this Server field.
+	Server &server_header(const std::string &value);
+	// Replaces the response the server sends itself with response.status, like 404 when no route
+	// matches, 405 when none matches the method, 400 for a bad target, or 503 when shedding load
+	Server &error_response(const FixedResponse &response);
+	// Connections that waited for a worker for longer than this get a 503 instead of being handled.
+	// Zero, the default, waits indefinitely.
+	Server &queue_deadline(std::chrono::milliseconds deadline);
+	// At most this many connections are open at once. When there are that many, the ones that have
+	// been idle the longest are closed to make room, and if none are idle, accepting pauses until one
+	// closes. Zero, the default, is no limit.
+	Server &max_connections(size_t max);
+	// Serve HTTPS instead of HTTP. The handshake is done asynchronously before the connection goes
+	// to a worker. Throws if the certificate or key can't be loaded, or if Woof was built without
+	// TLS support (WOOF_TLS).
+	Server &tls(const TlsConfig &config);
+	
+	ConnectionStats connection_stats() const;
 	
 	template<class Middleware>
 	void
@@ -503,187 +1088,289 @@ public:
 	add_middleware()
 	{ add_middleware<Middleware>(PathPattern::make<pattern>()); }
 	
+	// Logs the requests the handlers get to the logger, without a middleware or any allocation. Only
+	// the first call counts, later ones are logged and ignored.
+	void access_log(const AsyncLogger &logger, const PathPattern &path);
+	
+	void
+	access_log(const AsyncLogger &logger, const std::string &pattern = "/**")
+	{ access_log(logger, PathPattern::make(pattern)); }
+	
+	// The first cache whose pattern matches a request is used
+	void cache(const ResponseCache &cache, const PathPattern &path);
+	
+	void
+	cache(const ResponseCache &cache, const std::string &pattern = "/**")
+	{ this->cache(cache, PathPattern::make(pattern)); }
+	
+	// Identical concurrent GET and HEAD requests matching the pattern are handled once. The first one
+	// runs the middlewares and the handler, the others wait for a copy of its response without
+	// holding up a worker, and get a 503 if it takes longer than `timeout`. Requests are identical if
+	// their method, decoded target and `vary` headers are, so only use it where the response doesn't
+	// depend on anything else. Requests with a body, WebSocket and event stream endpoints, and
+	// requests with an Authorization or Cookie header that isn't in `vary` are never coalesced.
+	void coalesce(const PathPattern &path, const std::vector<std::string> &vary = {}, std::chrono::milliseconds timeout = std::chrono::seconds(10));
+	
+	void
+	coalesce(const std::string &pattern, const std::vector<std::string> &vary = {}, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+	{ coalesce(PathPattern::make(pattern), vary, timeout); }
+	
+	// Requests matching the pattern that are over the limit get a 429 with a Retry-After header,
+	// right after the request head is read. Every limiter whose pattern matches has to let it through.
+	void rate_limit(const RateLimiter &limiter, const PathPattern &path);
+	
+	void
+	rate_limit(const RateLimiter &limiter, const std::string &pattern = "/**")
+	{ rate_limit(limiter, PathPattern::make(pattern)); }
+	
+	// Requests over the limit get a 503. Checked after the rate limits and the response cache, so
+	// neither rejected requests nor cache hits count towards it.
+	void concurrency_limit(const ConcurrencyLimiter &limiter);
+	
+	// At most `max_in_flight` requests matching the pattern are handled at once, the others get a
+	// 503. It keeps a slow route from taking up all the workers.
+	void bulkhead(int max_in_flight, const PathPattern &path);
+	
+	void
+	bulkhead(int max_in_flight, const std::string &pattern)
+	{ bulkhead(max_in_flight, PathPattern::make(pattern)); }
+	
+	// multipart/form-data bodies of requests matching the pattern are parsed into Request::parts()
+	// while they're read, instead of being held in Request::body(). The first config whose pattern
+	// matches is used. A malformed body gets a 400 before the handler is called.
+	void multipart(const MultipartConfig &config, const PathPattern &path);
+	
+	void
+	multipart(const MultipartConfig &config, const std::string &pattern = "/**")
+	{ multipart(config, PathPattern::make(pattern)); }
+	
 	void run(int nworkers);
 	
 	void add_endpoint(Method method, const PathPattern &path, const RequestHandler &handler);
 	
+	// A GET endpoint that upgrades to a WebSocket, after the middlewares' before() have been called.
+	// If one of them sets a status other than 200, that's the response instead. The connection then
+	// runs asynchronously, without holding up a worker.
+	void add_websocket(const PathPattern &path, const WebSocketHandlers &handlers);
+	
+	void
+	add_websocket(const std::string &path, const WebSocketHandlers &handlers)
+	{ add_websocket(PathPattern::make(path), handlers); }
+	
+	template<StringConstant path>
+	void
+	WS(const WebSocketHandlers &handlers)
+	{ add_websocket(PathPattern::make<path>(), handlers); }
+	
+	// A GET endpoint that subscribes to the channel, after the middlewares' before() have been
+	// called. Like WebSockets, subscribers don't hold up workers. Over HTTP/2, the client is told to
+	// retry with HTTP/1.1.
+	void add_event_stream(const PathPattern &path, const EventChannel &channel);
+	
+	void
+	add_event_stream(const std::string &path, const EventChannel &channel)
+	{ add_event_stream(PathPattern::make(path), channel); }
+	
+	template<StringConstant path>
+	void
+	SSE(const EventChannel &channel)
+	{ add_event_stream(PathPattern::make<path>(), channel); }
+	
 	void
 	add_endpoint(Method method, const std::string &path, const RequestHandler &handler)
 	{ add_endpoint(method, PathPattern::make(path), handler); }
 	
+	// An endpoint that always sends the same response, like a health check. It's written right after
+	// routing, without the rate limits, the middlewares, or reading the request body.
+	void add_fixed_response(Method method, const PathPattern &path, const FixedResponse &response);
+	
+	void
+	add_fixed_response(Method method, const std::string &path, const FixedResponse &response)
+	{ add_fixed_response(method, PathPattern::make(path), response); }
+	
 	template<StringConstant path>
 	void
-	add_endpoint(Method method, const RequestHandler &handler)
-	{ add_endpoint(method, PathPattern::make<path>(), handler); }
+	add_fixed_response(Method method, const FixedResponse &response)
+	{ add_fixed_response(method, PathPattern::make<path>(), response); }
+	
+	// The handler either takes (Request &, Response &), or additionally the values of all the path
+	// params, converted to the types declared in the pattern: "/users/{id:u64}" gives a uint64_t
+	// and "/users/{name}" a std::string_view.
+	template<StringConstant path, class F>
+	void
+	add_endpoint(Method method, F &&handler)
+	{
+		if constexpr (std::is_invocable_v<F &, Request &, Response &>) {
+			add_endpoint(method, PathPattern::make<path>(), RequestHandler(std::forward<F>(handler)));
+		} else {
+			add_endpoint(method, PathPattern::make<path>(), typed_handler<path>(std::forward<F>(handler)));
+		}
+	}
 	
 	void
 	GET(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::GET, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	GET(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::GET, handler); }
+	GET(F &&handler)
+	{ add_endpoint<path>(Method::GET, std::forward<F>(handler)); }
 	
 	void
 	HEAD(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::HEAD, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	HEAD(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::HEAD, handler); }
+	HEAD(F &&handler)
+	{ add_endpoint<path>(Method::HEAD, std::forward<F>(handler)); }
 	
 	void
 	POST(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::POST, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	POST(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::POST, handler); }
+	POST(F &&handler)
+	{ add_endpoint<path>(Method::POST, std::forward<F>(handler)); }
 	
 	void
 	PUT(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::PUT, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	PUT(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::PUT, handler); }
+	PUT(F &&handler)
+	{ add_endpoint<path>(Method::PUT, std::forward<F>(handler)); }
 	
 	void
 	DELETE(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::DELETE, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	DELETE(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::DELETE, handler); }
+	DELETE(F &&handler)
+	{ add_endpoint<path>(Method::DELETE, std::forward<F>(handler)); }
 	
 	void
 	CONNECT(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::CONNECT, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	CONNECT(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::CONNECT, handler); }
+	CONNECT(F &&handler)
+	{ add_endpoint<path>(Method::CONNECT, std::forward<F>(handler)); }
 	
 	void
 	OPTIONS(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::OPTIONS, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	OPTIONS(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::OPTIONS, handler); }
+	OPTIONS(F &&handler)
+	{ add_endpoint<path>(Method::OPTIONS, std::forward<F>(handler)); }
 	
 	void
 	TRACE(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::TRACE, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	TRACE(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::TRACE, handler); }
+	TRACE(F &&handler)
+	{ add_endpoint<path>(Method::TRACE, std::forward<F>(handler)); }
 	
 	void
 	PATCH(const auto &path, const RequestHandler &handler)
 	{ add_endpoint(Method::PATCH, path, handler); }
 	
-	template<StringConstant path>
+	template<StringConstant path, class F>
 	void
-	PATCH(const RequestHandler &handler)
-	{ add_endpoint<path>(Method::PATCH, handler); }
+	PATCH(F &&handler)
+	{ add_endpoint<path>(Method::PATCH, std::forward<F>(handler)); }
 	
 private:
 	
+	template<StringConstant path, class F>
+	static RequestHandler
+	typed_handler(F &&f)
+	{
+		static constexpr size_t nparams = std::max(scan_param_types(path.chars), 0);
+		static constexpr auto types = [] {
+			std::array<ParamType, nparams> types {};
+			scan_param_types(path.chars, types.data());
+			return types;
+		}();
+		return [f = std::forward<F>(f)](Request &req, Response &resp) {
+			[&]<size_t... I>(std::index_sequence<I...>) {
+				f(req, resp, req.path().typed<types[I]>(I)...);
+			}(std::make_index_sequence<nparams>());
+		};
+	}
+	
 	void do_add_middleware(size_t hash, const PathPattern &path, const MiddlewareCreator &mw);
 }; // class Server
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// signed integer types
+// Parses an unsigned decimal integer, the whole string has to be digits. Returns false on overflow.
+bool parse_decimal(std::string_view s, uint64_t &x) noexcept;
 
-template<>
-struct StringConverter<short> {
-	static bool convert(short &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
-
-template<>
-struct StringConverter<int> {
-	static bool convert(int &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
+// Decodes %XX escapes and '+' in a query or form component. Only copies into buf if there's
+// anything to decode, otherwise s is left alone. Returns false on a malformed escape.
+bool form_decode(std::string_view &s, std::string &buf);
 
-template<>
-struct StringConverter<long> {
-	static bool convert(long &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
-
-template<>
-struct StringConverter<long long> {
-	static bool convert(long long &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
-
-// unsigned integer types
-
-template<>
-struct StringConverter<unsigned short> {
-	static bool convert(unsigned short &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
 
-template<>
-struct StringConverter<unsigned int> {
-	static bool convert(unsigned int &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
+// integer types, parsed with parse_decimal
 
-template<>
-struct StringConverter<unsigned long> {
-	static bool convert(unsigned long &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
+template<class T>
+struct IntegerConverter {
+	static bool convert(T &x, std::string_view s) {
+		bool negative = std::is_signed_v<T> && !s.empty() && s[0] == '-';
+		uint64_t v;
+		if (!parse_decimal(s.substr(negative), v)) return false;
+		if (negative) {
+			if (v > uint64_t(std::numeric_limits<T>::max()) + 1) return false;
+			x = T(std::make_unsigned_t<T>(0) - std::make_unsigned_t<T>(v));
+		} else {
+			if (v > uint64_t(std::numeric_limits<T>::max())) return false;
+			x = T(v);
+		}
+		return true;
 	}
 };
 
-template<>
-struct StringConverter<unsigned long long> {
-	static bool convert(unsigned long long &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
-	}
-};
+template<> struct StringConverter<short>              : IntegerConverter<short> {};
+template<> struct StringConverter<int>                : IntegerConverter<int> {};
+template<> struct StringConverter<long>               : IntegerConverter<long> {};
+template<> struct StringConverter<long long>          : IntegerConverter<long long> {};
+template<> struct StringConverter<unsigned short>     : IntegerConverter<unsigned short> {};
+template<> struct StringConverter<unsigned int>       : IntegerConverter<unsigned int> {};
+template<> struct StringConverter<unsigned long>      : IntegerConverter<unsigned long> {};
+template<> struct StringConverter<unsigned long long> : IntegerConverter<unsigned long long> {};
 
 // floating point types
 
 template<>
 struct StringConverter<float> {
-	static bool convert(float &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
+	static bool convert(float &x, std::string_view s) {
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+		return ec == std::errc() && ptr == s.data() + s.size();
 	}
 };
 
 template<>
 struct StringConverter<double> {
-	static bool convert(double &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
+	static bool convert(double &x, std::string_view s) {
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+		return ec == std::errc() && ptr == s.data() + s.size();
 	}
 };
 
 template<>
 struct StringConverter<long double> {
-	static bool convert(long double &x, const std::string &s) {
-		return std::from_chars(&s.front(), &s.back() + 1, x).ec == std::errc();
+	static bool convert(long double &x, std::string_view s) {
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), x);
+		return ec == std::errc() && ptr == s.data() + s.size();
 	}
 };
 
@@ -691,7 +1378,7 @@ struct StringConverter<long double> {
 
 template<>
 struct StringConverter<bool> {
-	static bool convert(bool &x, const std::string &s) {
+	static bool convert(bool &x, std::string_view s) {
 		if (s.empty())   goto yes;
 		if (s == "1")    goto yes;
 		if (s == "true") goto yes;
@@ -709,6 +1396,152 @@ struct StringConverter<bool> {
 	}
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Describes a field of a struct for bind_form. Fields are required unless `required` is false, or
+// the member is a std::optional or a std::vector. Vectors collect all the values of a repeated
+// key, otherwise the last value wins.
+template<StringConstant key, auto member, bool required = true>
+struct FormField {
+	static constexpr std::string_view name {key.chars, key.length};
+	static constexpr bool is_required = required;
+	
+	template<class T>
+	static auto &
+	get(T &obj) noexcept
+	{ return obj.*member; }
+};
+
+template<class... Fields>
+struct FormFields {};
+
+template<class T>
+struct BindResult {
+	T value {};
+	std::vector<std::string_view> missing;
+	std::vector<std::string_view> invalid;
+	
+	explicit operator bool() const noexcept
+	{ return missing.empty() && invalid.empty(); }
+};
+
+template<class T>
+struct _form_member {
+	static constexpr bool multi = false;
+	static constexpr bool optional = false;
+	
+	static bool assign(T &x, std::string_view s) {
+		if constexpr (std::is_same_v<T, std::string>) {
+			x = s;
+			return true;
+		} else {
+			return _string_convert<StringConverter<T>>(x, s);
+		}
+	}
+};
+
+template<class T>
+struct _form_member<std::optional<T>> {
+	static constexpr bool multi = false;
+	static constexpr bool optional = true;
+	
+	static bool assign(std::optional<T> &x, std::string_view s) {
+		T val {};
+		if (!_form_member<T>::assign(val, s)) return false;
+		x = std::move(val);
+		return true;
+	}
+};
+
+template<class T>
+struct _form_member<std::vector<T>> {
+	static constexpr bool multi = true;
+	static constexpr bool optional = true;
+	
+	static bool assign(std::vector<T> &x, std::string_view s) {
+		T val {};
+		if (!_form_member<T>::assign(val, s)) return false;
+		x.push_back(std::move(val));
+		return true;
+	}
+};
+
+template<class T, class... Fields>
+BindResult<T>
+_bind_form(std::string_view s, FormFields<Fields...>)
+{
+	constexpr size_t N = sizeof...(Fields);
+	BindResult<T> result;
+	std::array<bool, N> seen {};
+	std::array<bool, N> bad {};
+	std::string key_buf, value_buf;
+	
+	while (!s.empty()) {
+		size_t amp = s.find('&');
+		std::string_view pair = s.substr(0, amp);
+		s = amp == std::string_view::npos ? std::string_view() : s.substr(amp + 1);
+		
+		size_t eq = pair.find('=');
+		std::string_view key = pair.substr(0, eq);
+		std::string_view value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+		if (!form_decode(key, key_buf)) continue;
+		
+		[&]<size_t... I>(std::index_sequence<I...>) {
+			(... || [&] {
+				using F = std::tuple_element_t<I, std::tuple<Fields...>>;
+				if (key != F::name) return false;
+				auto &member = F::get(result.value);
+				using M = std::remove_reference_t<decltype(member)>;
+				seen[I] = true;
+				std::string_view v = value;
+				bad[I] = !form_decode(v, value_buf) || !_form_member<M>::assign(member, v) || (_form_member<M>::multi && bad[I]);
+				return true;
+			}());
+		}(std::index_sequence_for<Fields...>());
+	}
+	
+	[&]<size_t... I>(std::index_sequence<I...>) {
+		([&] {
+			using F = std::tuple_element_t<I, std::tuple<Fields...>>;
+			using M = std::remove_reference_t<decltype(F::get(result.value))>;
+			if (bad[I]) {
+				result.invalid.push_back(F::name);
+			} else if (!seen[I] && F::is_required && !_form_member<M>::optional) {
+				result.missing.push_back(F::name);
+			}
+		}(), ...);
+	}(std::index_sequence_for<Fields...>());
+	
+	return result;
+}
+
+// Binds a query string or an application/x-www-form-urlencoded body to a struct, which describes its
+// fields with a `fields` member type:
+//
+//	struct Search {
+//		std::string q;
+//		int page = 1;
+//		std::vector<std::string> tag;
+//		using fields = woof::FormFields<
+//			woof::FormField<"q", &Search::q>,
+//			woof::FormField<"page", &Search::page, false>,
+//			woof::FormField<"tag", &Search::tag>
+//		>;
+//	};
+//
+// All the missing and invalid fields are reported at once. Unknown keys are ignored.
+template<class T>
+BindResult<T>
+bind_form(std::string_view s)
+{ return _bind_form<T>(s, typename T::fields()); }
+
+#include <woof/json.hpp>
+
+template<class T>
+void
+Response::json(const T &x)
+{ json_writer().value(x); }
+
 } // namespace woof
 
 #endif // C++ 20 check
@@ -0,0 +1,556 @@
+// woof_loadgen -- drives an HTTP/1.1 server over loopback and reports throughput and latency.
+//
+// In open-loop mode (--rate > 0) every request has an intended send time on a fixed schedule, and
+// its latency is measured from that time rather than from when it actually went out. A server that
+// stalls therefore shows up in the percentiles instead of silently slowing the generator down
+// (the coordinated omission problem). With --rate 0 it runs closed-loop, keeping --pipeline
+// requests in flight on every connection.
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+using error_code = boost::system::error_code;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct RequestTemplate {
+	int weight;
+	bool head;
+	std::string bytes;
+};
+
+struct Options {
+	std::string host = "127.0.0.1";
+	int port = 8888;
+	int connections = 16;
+	int threads = 1;
+	int pipeline = 1;
+	double rate = 0;
+	double duration = 10;
+	double warmup = 1;
+	bool json = false;
+	std::vector<std::string> headers;
+	std::vector<std::pair<int, std::string>> mix;
+	std::vector<RequestTemplate> requests;
+};
+
+// Log-linear histogram of nanosecond values, 128 sub-buckets per power of two (< 0.8% error)
+class Histogram {
+	static constexpr int SUB_BITS = 7;
+	static constexpr uint64_t SUB = 1 << SUB_BITS;
+	std::vector<uint64_t> counts = std::vector<uint64_t>(2 * SUB + 64 * SUB);
+	uint64_t total = 0;
+	uint64_t max_value = 0;
+	long double sum = 0;
+	
+	static size_t
+	index(uint64_t v)
+	{
+		if (v < 2 * SUB) return v;
+		int shift = std::bit_width(v) - SUB_BITS - 1;
+		return SUB * shift + (v >> shift);
+	}
+	
+	static uint64_t
+	value(size_t idx)
+	{
+		if (idx < 2 * SUB) return idx;
+		int shift = idx / SUB - 1;
+		return (idx - SUB * shift) << shift;
+	}
+	
+public:
+	
+	void
+	record(uint64_t v)
+	{
+		++counts[index(v)];
+		++total;
+		sum += v;
+		max_value = std::max(max_value, v);
+	}
+	
+	void
+	merge(const Histogram &other)
+	{
+		for (size_t i = 0; i < counts.size(); ++i) {
+			counts[i] += other.counts[i];
+		}
+		total += other.total;
+		sum += other.sum;
+		max_value = std::max(max_value, other.max_value);
+	}
+	
+	uint64_t count() const { return total; }
+	uint64_t max() const { return max_value; }
+	double mean() const { return total ? double(sum / total) : 0; }
+	
+	uint64_t
+	percentile(double p) const
+	{
+		uint64_t rank = std::max<uint64_t>(1, uint64_t(p / 100 * total + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < counts.size(); ++i) {
+			seen += counts[i];
+			if (seen >= rank) return std::min(value(i), max_value);
+		}
+		return max_value;
+	}
+};
+
+struct Stats {
+	Histogram latency;
+	uint64_t status_classes[6] {};
+	uint64_t errors = 0;
+	uint64_t reconnects = 0;
+	uint64_t bytes_read = 0;
+	
+	void
+	merge(const Stats &other)
+	{
+		latency.merge(other.latency);
+		for (int i = 0; i < 6; ++i) status_classes[i] += other.status_classes[i];
+		errors += other.errors;
+		reconnects += other.reconnects;
+		bytes_read += other.bytes_read;
+	}
+};
+
+struct Worker;
+
+class Connection : public std::enable_shared_from_this<Connection> {
+	struct Pending {
+		Clock::time_point intended;
+		const RequestTemplate *request;
+	};
+	
+	Worker &w;
+	tcp::socket socket;
+	beast::flat_buffer buffer;
+	std::optional<http::response_parser<http::string_body>> parser;
+	asio::steady_timer timer;
+	asio::steady_timer retry;
+	std::minstd_rand rng;
+	Clock::duration interval;
+	Clock::time_point next_send;
+	std::deque<Pending> backlog;  // scheduled, but not yet sent because the pipeline is full
+	std::deque<Pending> inflight; // sent, waiting for the response
+	std::string out, writing;
+	unsigned generation = 0; // bumped on every reconnect, so stale completions can be told apart
+	bool connected = false;
+	bool reading = false;
+	bool closed = false;
+	
+public:
+	
+	Connection(Worker &w_, unsigned seed);
+	
+	void start();
+	void stop();
+	
+private:
+	
+	void connect();
+	void schedule();
+	Pending next_request(Clock::time_point intended = {});
+	void enqueue(Clock::time_point intended);
+	void pump();
+	void flush();
+	void read();
+	void fail(error_code ec);
+};
+
+struct Worker {
+	const Options &opt;
+	asio::io_context ioc {1};
+	tcp::endpoint endpoint;
+	std::vector<std::shared_ptr<Connection>> connections;
+	asio::steady_timer deadline {ioc};
+	Clock::time_point measure_from;
+	Clock::time_point stop_at;
+	std::discrete_distribution<size_t> pick;
+	Stats stats;
+	int nconnections;
+	int active = 0;
+	bool stopping = false;
+	
+	Worker(const Options &opt_, int nconnections_, Clock::time_point start)
+	:
+		opt(opt_),
+		endpoint(asio::ip::make_address(opt_.host), opt_.port),
+		measure_from(start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt_.warmup))),
+		stop_at(measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt_.duration))),
+		nconnections(nconnections_)
+	{
+		std::vector<int> weights;
+		for (auto &r : opt.requests) weights.push_back(r.weight);
+		pick = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+	}
+	
+	void
+	run(unsigned seed)
+	{
+		for (int i = 0; i < nconnections; ++i) {
+			connections.push_back(std::make_shared<Connection>(*this, seed + i));
+			connections.back()->start();
+		}
+		active = nconnections;
+		
+		// Stop scheduling at the deadline, then give outstanding requests a moment to finish
+		deadline.expires_at(stop_at);
+		deadline.async_wait([this](error_code ec) {
+			if (ec) return;
+			stopping = true;
+			deadline.expires_after(std::chrono::seconds(2));
+			deadline.async_wait([this](error_code ec) {
+				if (ec) return;
+				for (auto &c : connections) c->stop();
+			});
+		});
+		ioc.run();
+	}
+	
+	void
+	connection_done()
+	{
+		if (--active == 0) deadline.cancel();
+	}
+};
+
+Connection::Connection(Worker &w_, unsigned seed)
+:
+	w(w_),
+	socket(w_.ioc),
+	timer(w_.ioc),
+	retry(w_.ioc),
+	rng(seed)
+{
+	double per_connection = w.opt.rate / (w.opt.connections);
+	if (per_connection > 0) {
+		interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / per_connection));
+	}
+}
+
+void
+Connection::start()
+{
+	// Spread the connections' schedules evenly over one interval
+	next_send = Clock::now() + interval * (rng() % 1024) / 1024;
+	connect();
+	if (w.opt.rate > 0) {
+		schedule();
+	} else {
+		for (int i = 0; i < w.opt.pipeline; ++i) enqueue(Clock::now());
+	}
+}
+
+void
+Connection::stop()
+{
+	if (closed) return;
+	closed = true;
+	w.connection_done();
+	timer.cancel();
+	retry.cancel();
+	error_code ec;
+	socket.close(ec);
+}
+
+void
+Connection::connect()
+{
+	socket.async_connect(w.endpoint, [self = shared_from_this(), gen = generation](error_code ec) {
+		if (self->closed || gen != self->generation) return;
+		if (ec) return self->fail(ec);
+		self->socket.set_option(tcp::no_delay(true));
+		self->connected = true;
+		self->pump();
+	});
+}
+
+void
+Connection::schedule()
+{
+	if (w.stopping || closed) return;
+	auto now = Clock::now();
+	while (next_send <= now) {
+		enqueue(next_send);
+		next_send += interval;
+	}
+	timer.expires_at(next_send);
+	timer.async_wait([self = shared_from_this()](error_code ec) {
+		if (!ec) self->schedule();
+	});
+}
+
+Connection::Pending
+Connection::next_request(Clock::time_point intended)
+{
+	return {intended, &w.opt.requests[w.pick(rng)]};
+}
+
+void
+Connection::enqueue(Clock::time_point intended)
+{
+	backlog.push_back(next_request(intended));
+	pump();
+}
+
+void
+Connection::pump()
+{
+	if (!connected) return;
+	while (!backlog.empty() && int(inflight.size()) < w.opt.pipeline) {
+		Pending p = backlog.front();
+		backlog.pop_front();
+		// In closed-loop mode the clock starts when the request is actually sent
+		if (w.opt.rate <= 0) p.intended = Clock::now();
+		out += p.request->bytes;
+		inflight.push_back(p);
+	}
+	flush();
+	if (!reading && !inflight.empty()) read();
+}
+
+void
+Connection::flush()
+{
+	if (!connected || !writing.empty() || out.empty()) return;
+	std::swap(out, writing);
+	asio::async_write(socket, asio::buffer(writing), [self = shared_from_this(), gen = generation](error_code ec, size_t) {
+		self->writing.clear();
+		if (self->closed) return;
+		if (gen == self->generation && ec) return self->fail(ec);
+		self->flush();
+	});
+}
+
+void
+Connection::read()
+{
+	reading = true;
+	parser.emplace();
+	parser->body_limit(std::numeric_limits<uint64_t>::max());
+	if (inflight.front().request->head) parser->skip(true);
+	http::async_read(socket, buffer, *parser, [self = shared_from_this(), gen = generation](error_code ec, size_t nread) {
+		if (self->closed || gen != self->generation) return;
+		self->reading = false;
+		if (ec) return self->fail(ec);
+		auto now = Clock::now();
+		Worker &w = self->w;
+		if (!self->inflight.empty()) {
+			Pending p = self->inflight.front();
+			self->inflight.pop_front();
+			if (p.intended >= w.measure_from && p.intended < w.stop_at) {
+				int status = self->parser->get().result_int();
+				w.stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - p.intended).count());
+				w.stats.status_classes[std::clamp(status / 100, 0, 5)] += 1;
+				w.stats.bytes_read += nread;
+			}
+		}
+		if (w.opt.rate <= 0 && !w.stopping) self->backlog.push_back(self->next_request());
+		if (w.stopping && self->inflight.empty() && self->backlog.empty()) return self->stop();
+		if (!self->parser->get().keep_alive()) return self->fail({});
+		self->pump();
+	});
+}
+
+void
+Connection::fail(error_code ec)
+{
+	if (closed) return;
+	if (ec && ec != http::error::end_of_stream && ec != asio::error::eof) {
+		w.stats.errors += 1;
+	}
+	// Requests that never got a response are resent on a new connection, keeping their intended
+	// send times so the reconnect shows up in their latency
+	for (auto it = inflight.rbegin(); it != inflight.rend(); ++it) {
+		backlog.push_front(*it);
+	}
+	inflight.clear();
+	out.clear();
+	buffer.clear();
+	connected = false;
+	reading = false;
+	generation += 1;
+	error_code ignored;
+	socket.close(ignored);
+	socket = tcp::socket(w.ioc);
+	if (w.stopping && backlog.empty()) return stop();
+	w.stats.reconnects += 1;
+	if (ec == asio::error::connection_refused) {
+		// Don't spin while the server is down
+		retry.expires_after(std::chrono::milliseconds(10));
+		retry.async_wait([self = shared_from_this()](error_code ec) {
+			if (!ec && !self->closed) self->connect();
+		});
+	} else {
+		connect();
+	}
+}
+
+void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -h, --host ADDR         server address (default 127.0.0.1)\n"
+		"  -p, --port PORT         server port (default 8888)\n"
+		"  -c, --connections N     concurrent connections (default 16)\n"
+		"  -t, --threads N         generator threads (default 1)\n"
+		"  -d, --pipeline N        requests in flight per connection (default 1)\n"
+		"  -R, --rate RPS          total open-loop request rate, 0 for closed-loop (default 0)\n"
+		"  -D, --duration SEC      measured duration (default 10)\n"
+		"  -w, --warmup SEC        unmeasured warmup before that (default 1)\n"
+		"  -r, --request SPEC      [WEIGHT:]METHOD TARGET [BODY], may be repeated (default GET /)\n"
+		"  -H, --header LINE       extra request header, may be repeated\n"
+		"  -j, --json              print the report as JSON\n",
+		argv0
+	);
+}
+
+bool
+parse_options(int argc, char **argv, Options &opt)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&]() -> const char * {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Missing value for %s\n", arg.c_str());
+				exit(2);
+			}
+			return argv[++i];
+		};
+		if (arg == "-h" || arg == "--host") opt.host = value();
+		else if (arg == "-p" || arg == "--port") opt.port = atoi(value());
+		else if (arg == "-c" || arg == "--connections") opt.connections = std::max(1, atoi(value()));
+		else if (arg == "-t" || arg == "--threads") opt.threads = std::max(1, atoi(value()));
+		else if (arg == "-d" || arg == "--pipeline") opt.pipeline = std::max(1, atoi(value()));
+		else if (arg == "-R" || arg == "--rate") opt.rate = atof(value());
+		else if (arg == "-D" || arg == "--duration") opt.duration = atof(value());
+		else if (arg == "-w" || arg == "--warmup") opt.warmup = atof(value());
+		else if (arg == "-H" || arg == "--header") opt.headers.push_back(value());
+		else if (arg == "-j" || arg == "--json") opt.json = true;
+		else if (arg == "-r" || arg == "--request") {
+			std::string spec = value();
+			int weight = 1;
+			size_t colon = spec.find(':');
+			if (colon != std::string::npos && colon < spec.find(' ')) {
+				weight = atoi(spec.substr(0, colon).c_str());
+				spec = spec.substr(colon + 1);
+			}
+			opt.mix.emplace_back(std::max(weight, 0), spec);
+		} else {
+			usage(argv[0]);
+			return false;
+		}
+	}
+	if (opt.mix.empty()) opt.mix.emplace_back(1, "GET /");
+	opt.connections = std::max(opt.connections, opt.threads);
+	
+	for (auto &[weight, spec] : opt.mix) {
+		size_t sp1 = spec.find(' ');
+		if (sp1 == std::string::npos) {
+			fprintf(stderr, "Bad request spec: %s\n", spec.c_str());
+			return false;
+		}
+		size_t sp2 = spec.find(' ', sp1 + 1);
+		std::string method = spec.substr(0, sp1);
+		std::string target = spec.substr(sp1 + 1, sp2 == std::string::npos ? std::string::npos : sp2 - sp1 - 1);
+		std::string body = sp2 == std::string::npos ? "" : spec.substr(sp2 + 1);
+		
+		std::string bytes = method + " " + target + " HTTP/1.1\r\n";
+		bytes += "Host: " + opt.host + ":" + std::to_string(opt.port) + "\r\n";
+		bytes += "User-Agent: woof_loadgen\r\n";
+		for (auto &h : opt.headers) bytes += h + "\r\n";
+		if (!body.empty() || method == "POST" || method == "PUT" || method == "PATCH") {
+			bytes += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+		}
+		bytes += "\r\n" + body;
+		opt.requests.push_back({weight, method == "HEAD", std::move(bytes)});
+	}
+	return true;
+}
+
+void
+report(const Options &opt, const Stats &stats)
+{
+	const Histogram &h = stats.latency;
+	double throughput = h.count() / opt.duration;
+	auto us = [](uint64_t ns) { return ns / 1e3; };
+	if (opt.json) {
+		printf("{\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"rate\":%.1f,\"duration\":%.3f,"
+			"\"requests\":%llu,\"throughput\":%.1f,\"bytes_read\":%llu,\"errors\":%llu,\"reconnects\":%llu,"
+			"\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu},"
+			"\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p99.9\":%.1f,\"max\":%.1f}}\n",
+			opt.connections, opt.threads, opt.pipeline, opt.rate, opt.duration,
+			(unsigned long long) h.count(), throughput, (unsigned long long) stats.bytes_read,
+			(unsigned long long) stats.errors, (unsigned long long) stats.reconnects,
+			(unsigned long long) stats.status_classes[1], (unsigned long long) stats.status_classes[2],
+			(unsigned long long) stats.status_classes[3], (unsigned long long) stats.status_classes[4],
+			(unsigned long long) stats.status_classes[5],
+			h.mean() / 1e3, us(h.percentile(50)), us(h.percentile(90)), us(h.percentile(99)),
+			us(h.percentile(99.9)), us(h.max())
+		);
+		return;
+	}
+	printf("%s, %d connections, %d threads, pipeline depth %d",
+		opt.rate > 0 ? "Open loop" : "Closed loop", opt.connections, opt.threads, opt.pipeline);
+	if (opt.rate > 0) printf(", target %.0f req/s", opt.rate);
+	printf("\n");
+	printf("  requests    %llu in %.1fs, %.1f req/s, %.2f MB/s read\n",
+		(unsigned long long) h.count(), opt.duration, throughput, stats.bytes_read / opt.duration / 1e6);
+	printf("  status      1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu\n",
+		(unsigned long long) stats.status_classes[1], (unsigned long long) stats.status_classes[2],
+		(unsigned long long) stats.status_classes[3], (unsigned long long) stats.status_classes[4],
+		(unsigned long long) stats.status_classes[5]);
+	printf("  errors      %llu, reconnects %llu\n", (unsigned long long) stats.errors, (unsigned long long) stats.reconnects);
+	printf("  latency     mean %.1fus\n", h.mean() / 1e3);
+	printf("              p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus\n",
+		us(h.percentile(50)), us(h.percentile(90)), us(h.percentile(99)), us(h.percentile(99.9)), us(h.max()));
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char **argv)
+{
+	Options opt;
+	if (!parse_options(argc, argv, opt)) return 2;
+	
+	auto start = Clock::now();
+	std::vector<std::unique_ptr<Worker>> workers;
+	for (int i = 0; i < opt.threads; ++i) {
+		int n = opt.connections / opt.threads + (i < opt.connections % opt.threads);
+		workers.push_back(std::make_unique<Worker>(opt, n, start));
+	}
+	std::vector<std::thread> threads;
+	for (int i = 0; i < opt.threads; ++i) {
+		threads.emplace_back([&workers, i] { workers[i]->run(1000 * i + 1); });
+	}
+	for (auto &t : threads) t.join();
+	
+	Stats total;
+	for (auto &w : workers) total.merge(w->stats);
+	report(opt, total);
+	return total.latency.count() == 0;
+}
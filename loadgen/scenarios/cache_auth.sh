@@ -0,0 +1,24 @@
+#!/bin/sh
+# Not a load test: checks that a response cached for a request with credentials isn't served to one
+# without, and that requests without credentials still get hits.
+# Usage: cache_auth.sh
+
+. "$(dirname "$0")/common.sh"
+
+url="http://127.0.0.1:$PORT/cached/me"
+fail() {
+	echo "FAIL: $1" >&2
+	exit 1
+}
+
+curl -sf -H 'Authorization: Bearer secret' "$url" > /dev/null || fail "request with credentials"
+first=$(curl -sf "$url") || fail "request without credentials"
+case $first in
+	anonymous*) ;;
+	*) fail "got '$first' without credentials" ;;
+esac
+second=$(curl -sf "$url")
+[ "$second" = "$first" ] || fail "no cache hit without credentials: '$first', then '$second'"
+again=$(curl -sf -H 'Authorization: Bearer secret' "$url")
+[ "$again" != "$first" ] || fail "a request with credentials was served from the cache"
+echo OK
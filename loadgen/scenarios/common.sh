@@ -0,0 +1,41 @@
+# Sourced by the scenario scripts. Starts woof_loadgen_server on PORT and stops it on exit.
+#
+#   BUILD_DIR  directory with the built woof_loadgen and woof_loadgen_server (default: build)
+#   PORT       port to run the server on (default: 8888)
+#   WORKERS    server worker threads (default: number of CPUs)
+#   THREADS    load generator threads (default: 1)
+#   DURATION   measured seconds per run (default: 10)
+#   JSON       set to 1 for JSON reports
+#   STRACE     file to write a count of the server's system calls to, with strace -c
+
+set -eu
+
+BUILD_DIR=${BUILD_DIR:-build}
+PORT=${PORT:-8888}
+WORKERS=${WORKERS:-$(nproc)}
+THREADS=${THREADS:-1}
+DURATION=${DURATION:-10}
+
+LOADGEN="$BUILD_DIR/woof_loadgen"
+SERVER="$BUILD_DIR/woof_loadgen_server"
+
+for exe in "$LOADGEN" "$SERVER"; do
+	if [ ! -x "$exe" ]; then
+		echo "$exe not found, build it first or set BUILD_DIR" >&2
+		exit 1
+	fi
+done
+
+"$SERVER" "$PORT" "$WORKERS" > /dev/null &
+SERVER_PID=$!
+if [ -n "${STRACE:-}" ]; then
+	# Detaches and writes the summary when the server exits
+	strace -f -c -S calls -o "$STRACE" -p $SERVER_PID 2> /dev/null &
+	STRACE_PID=$!
+fi
+trap 'kill $SERVER_PID 2> /dev/null; wait $SERVER_PID 2> /dev/null || true; [ -z "${STRACE_PID:-}" ] || wait $STRACE_PID' EXIT
+sleep 0.5
+
+loadgen() {
+	"$LOADGEN" -p "$PORT" -t "$THREADS" -D "$DURATION" ${JSON:+-j} "$@"
+}
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Not a load test: checks that the streams of an HTTP/2 connection are handled concurrently, so that
+# a fast response isn't held up behind a slow handler. Needs nghttp, from nghttp2's client tools,
+# which sends all the requests on one connection.
+# Usage: h2_multiplex.sh
+#
+#   NGHTTP  the nghttp to use (default: nghttp)
+
+WORKERS=${WORKERS:-4}
+NGHTTP=${NGHTTP:-nghttp}
+. "$(dirname "$0")/common.sh"
+
+base="http://127.0.0.1:$PORT"
+fail() {
+	echo "FAIL: $1" >&2
+	exit 1
+}
+
+# The slow request goes first. The statistics list the streams in the order they completed, as
+# "id responseEnd requestStart process code size path".
+out=$("$NGHTTP" -ns "$base/slow?ms=1500" "$base/health") || fail "requests failed"
+streams=$(echo "$out" | sed -n '/^id  *responseEnd/,$p' | tail -n +2)
+[ "$(echo "$streams" | awk '$5 == 200' | wc -l)" = 2 ] || fail "expected two 200s: $streams"
+[ "$(echo "$streams" | head -n 1 | awk '{ print $7 }')" = /health ] || fail "the fast stream didn't complete first: $streams"
+echo OK
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compares the epoll and io_uring backends on the saturate workload: throughput untraced, then the
+# server's system calls per request in a second run under strace.
+# Usage: io_uring.sh EPOLL_BUILD_DIR URING_BUILD_DIR [CONNECTIONS]
+# The second build is configured with -DWOOF_IO_URING=ON. Needs strace.
+
+set -eu
+
+dir=$(dirname "$0")
+
+for build in "$1" "$2"; do
+	echo "== $build"
+	BUILD_DIR=$build sh "$dir/saturate.sh" "${3:-64}" | grep -E 'requests|latency|p50'
+	BUILD_DIR=$build STRACE="$build/syscalls.txt" sh "$dir/saturate.sh" "${3:-64}" > "$build/traced.txt"
+	requests=$(awk '/requests/ { print $2 }' "$build/traced.txt")
+	# The most frequent calls, and the total
+	awk -v n="$requests" '
+		/^-/ { next }
+		$4 ~ /^[0-9]+$/ && ++rows <= 8 || $NF == "total" {
+			printf "  %-16s %10d calls, %.2f per request\n", $NF, $4, $4 / n
+		}
+	' "$build/syscalls.txt"
+done
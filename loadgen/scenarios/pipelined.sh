@@ -0,0 +1,9 @@
+#!/bin/sh
+# Few connections with deep pipelines, as seen behind a connection-pooling proxy.
+# Usage: pipelined.sh [DEPTH]
+
+. "$(dirname "$0")/common.sh"
+
+loadgen -c 4 -d "${1:-16}" -R 20000 \
+	-r '9:GET /hello/pl?a=7' \
+	-r '1:POST /echo ping'
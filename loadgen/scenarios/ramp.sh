@@ -0,0 +1,10 @@
+#!/bin/sh
+# Open-loop runs at increasing rates, to find where latency starts to climb.
+# Usage: ramp.sh [RATE...]
+
+. "$(dirname "$0")/common.sh"
+
+[ $# -gt 0 ] || set -- 1000 2000 5000 10000 20000 50000
+for rate in "$@"; do
+	loadgen -c 64 -R "$rate" -r 'GET /hello/en?a=1'
+done
@@ -0,0 +1,7 @@
+#!/bin/sh
+# Closed-loop maximum throughput. Latencies here are not comparable to open-loop ones.
+# Usage: saturate.sh [CONNECTIONS]
+
+. "$(dirname "$0")/common.sh"
+
+loadgen -c "${1:-64}" -r 'GET /health'
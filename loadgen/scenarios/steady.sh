@@ -0,0 +1,11 @@
+#!/bin/sh
+# Typical API traffic at a fixed rate: mostly small GETs, some POSTs, a few health checks.
+# Usage: steady.sh [RATE]
+
+. "$(dirname "$0")/common.sh"
+
+loadgen -c 32 -R "${1:-5000}" \
+	-r '80:GET /hello/en?a=1' \
+	-r '10:GET /hello/fr' \
+	-r '8:POST /echo {"id":42,"name":"woof"}' \
+	-r '2:GET /health'
@@ -0,0 +1,61 @@
+// A quiet example_hello-style server for the load generator scenarios.
+// Usage: woof_loadgen_server [PORT [NWORKERS]]
+
+#include <woof/woof.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+int
+main(int argc, char **argv)
+{
+	int port = argc > 1 ? atoi(argv[1]) : 8888;
+	int nworkers = argc > 2 ? atoi(argv[2]) : 2;
+	
+	woof::Server srv;
+	
+	srv.GET<"/health">([](woof::Request &, woof::Response &resp) {
+		resp.body() << "OK\n";
+	});
+	
+	// The same response, written from its serialized form
+	srv.add_fixed_response<"/health/fixed">(woof::Method::GET, {.body = "OK\n"});
+	
+	srv.GET<"/hello/{lang}">(
+		[](woof::Request &req, woof::Response &resp) {
+			std::string_view lang = req.path()["lang"];
+			if      (lang == "en") resp.body() << "Hello";
+			else if (lang == "fr") resp.body() << "Salut";
+			else if (lang == "pl") resp.body() << "Cześć";
+			else {
+				resp.status(woof::status::NOT_FOUND);
+				return;
+			}
+			resp.body() << ", " << req.query().get_or<int>("a", 42) << "!\n";
+		}
+	);
+	
+	srv.POST<"/echo">([](woof::Request &req, woof::Response &resp) {
+		resp.body() << req.body().stream().rdbuf();
+	});
+	
+	// Cacheable, but depends on the credentials, for cache_auth.sh. The count shows hits.
+	woof::ResponseCache cache;
+	srv.cache(cache, "/cached/**");
+	std::atomic<int> calls = 0;
+	srv.GET<"/cached/me">([&calls](woof::Request &req, woof::Response &resp) {
+		const std::string *authorization = req.header(woof::Field::AUTHORIZATION);
+		resp.header(woof::Field::CACHE_CONTROL, "max-age=60");
+		resp.body() << (authorization ? *authorization : "anonymous") << " " << ++calls << "\n";
+	});
+	
+	// Holds up its worker, for h2_multiplex.sh
+	srv.GET<"/slow">([](woof::Request &req, woof::Response &resp) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(req.query().get_or<int>("ms", 1000)));
+		resp.body() << "slow\n";
+	});
+	
+	srv.address("127.0.0.1").port(port).run(nworkers);
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <tuple>
+
+namespace woof {
+
+namespace fs = std::filesystem;
+
+Server &
+Server::worker_affinity(const WorkerAffinity &affinity)
+{
+	m->worker_affinity = affinity;
+	return *this;
+}
+
+// Parses a sysfs CPU list like "0-3,8-11"
+static std::vector<int>
+parse_cpu_list(const std::string &s)
+{
+	std::vector<int> cpus;
+	size_t i = 0;
+	while (i < s.size()) {
+		size_t end = s.find(',', i);
+		if (end == std::string::npos) end = s.size();
+		std::string range = s.substr(i, end - i);
+		size_t dash = range.find('-');
+		try {
+			int first = std::stoi(range.substr(0, dash));
+			int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+		} catch (const std::exception &) {
+		}
+		i = end + 1;
+	}
+	return cpus;
+}
+
+static int
+read_int(const fs::path &path, int fallback)
+{
+	std::ifstream in(path);
+	int value;
+	return in >> value ? value : fallback;
+}
+
+// The node of each CPU, from /sys/devices/system/node. Without it everything is node 0.
+static std::map<int, int>
+cpu_nodes()
+{
+	std::map<int, int> nodes;
+	std::error_code ec;
+	for (auto &entry : fs::directory_iterator("/sys/devices/system/node", ec)) {
+		std::string name = entry.path().filename();
+		if (!name.starts_with("node") || name.size() == 4) continue;
+		int node = std::atoi(name.c_str() + 4);
+		std::ifstream in(entry.path() / "cpulist");
+		std::string list;
+		std::getline(in, list);
+		for (int cpu : parse_cpu_list(list)) nodes[cpu] = node;
+	}
+	return nodes;
+}
+
+std::vector<WorkerCpu>
+plan_worker_cpus(const ServerState &m, int nworkers)
+{
+	const WorkerAffinity &a = m.worker_affinity;
+	if (a.cpus.empty() && !a.automatic) return {};
+	auto nodes = cpu_nodes();
+	auto node_of = [&nodes](int cpu) {
+		auto it = nodes.find(cpu);
+		return it == nodes.end() ? 0 : it->second;
+	};
+	
+	std::vector<int> cpus = a.cpus;
+	if (cpus.empty()) {
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			m.warn(std::string("Couldn't get the CPU affinity: ") + strerror(errno));
+			return {};
+		}
+		// The first CPU seen on a physical core gets rank 0, its hyper-threads 1 and up
+		struct Candidate {
+			int rank, node, package, core, cpu;
+			auto operator<=>(const Candidate &) const = default;
+		};
+		std::vector<Candidate> candidates;
+		std::map<std::tuple<int, int, int>, int> threads_seen;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (!CPU_ISSET(cpu, &allowed)) continue;
+			fs::path topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology";
+			int node = node_of(cpu);
+			int package = read_int(topology / "physical_package_id", 0);
+			int core = read_int(topology / "core_id", cpu);
+			int rank = threads_seen[{node, package, core}]++;
+			candidates.push_back({rank, node, package, core, cpu});
+		}
+		std::sort(candidates.begin(), candidates.end());
+		for (auto &c : candidates) cpus.push_back(c.cpu);
+		if (cpus.empty()) return {};
+	}
+	
+	std::vector<WorkerCpu> plan;
+	for (int i = 0; i < nworkers; ++i) {
+		int cpu = cpus[i % cpus.size()];
+		plan.push_back({cpu, node_of(cpu)});
+	}
+	return plan;
+}
+
+// Nothing else is needed for NUMA-local memory: under the default policy, pages come from the node
+// of the CPU that first touches them, and glibc gives each thread its own malloc arena
+void
+pin_thread(const ServerState &m, const WorkerCpu &cpu)
+{
+	if (cpu.cpu < 0 || cpu.cpu >= CPU_SETSIZE) {
+		m.warn("Couldn't pin a worker to CPU " + std::to_string(cpu.cpu) + ": No such CPU");
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu.cpu, &set);
+	int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+	if (err != 0) {
+		m.warn("Couldn't pin a worker to CPU " + std::to_string(cpu.cpu) + ": " + strerror(err));
+	}
+}
+
+}
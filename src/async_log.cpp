@@ -0,0 +1,251 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+
+namespace woof {
+
+static std::atomic<uint64_t> next_logger_id = 1;
+
+// Rings registered by the current thread, keyed by AsyncLogState::id. Usually there's just one.
+static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<LogRing>>> thread_rings;
+
+AsyncLogState::AsyncLogState(size_t capacity_, LogOverflow overflow_, const LogHandler &sink_)
+:
+	id(next_logger_id++),
+	capacity(std::bit_ceil(std::max<size_t>(capacity_, 2))),
+	overflow(overflow_),
+	sink(sink_)
+{
+	thread = std::thread([this] { run(); });
+}
+
+AsyncLogState::~AsyncLogState()
+{
+	{
+		std::lock_guard lock(mutex);
+		stop = true;
+	}
+	cv.notify_one();
+	thread.join();
+	for (auto &ring : rings) {
+		ring->closed = true;
+	}
+}
+
+LogRing &
+AsyncLogState::ring()
+{
+	for (auto &[ring_id, ring] : thread_rings) {
+		if (ring_id == id) return *ring;
+	}
+	std::erase_if(thread_rings, [](const auto &entry) { return entry.second->closed.load(); });
+	auto ring = std::make_shared<LogRing>(capacity);
+	{
+		std::lock_guard lock(mutex);
+		rings.push_back(ring);
+	}
+	thread_rings.emplace_back(id, ring);
+	return *ring;
+}
+
+bool
+AsyncLogState::acquire(LogRing &ring, size_t n, size_t &tail)
+{
+	tail = ring.tail.load(std::memory_order_relaxed);
+	if (n > capacity) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	while (tail + n - ring.head.load(std::memory_order_acquire) > capacity) {
+		if (overflow == LogOverflow::DROP) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		notify();
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+void
+AsyncLogState::publish(LogRing &ring, size_t tail)
+{
+	size_t head = ring.head.load(std::memory_order_relaxed);
+	ring.tail.store(tail, std::memory_order_release);
+	if (tail - head > capacity / 2) notify();
+}
+
+void
+AsyncLogState::notify()
+{
+	// The background thread wakes up every interval anyway, so a lost wakeup only costs latency
+	if (!wakeup.exchange(true, std::memory_order_relaxed)) {
+		cv.notify_one();
+	}
+}
+
+void
+AsyncLogState::run()
+{
+	std::vector<std::shared_ptr<LogRing>> local_rings;
+	std::string batch, message;
+	uint64_t reported_dropped = 0;
+	
+	auto deliver = [this, &batch](LogLevel level, const char *str, size_t len) {
+		if (sink) {
+			sink(level, str, len);
+		} else {
+			batch.push_back('[');
+			batch.append(log_level_str(level));
+			batch.append("] ");
+			batch.append(str, len);
+			batch.push_back('\n');
+		}
+	};
+	
+	for (;;) {
+		bool stopping;
+		uint64_t flush_target;
+		{
+			std::unique_lock lock(mutex);
+			cv.wait_for(lock, std::chrono::milliseconds(interval_ms.load(std::memory_order_relaxed)), [this] {
+				return stop || wakeup.load(std::memory_order_relaxed) || flush_requested != flush_done;
+			});
+			wakeup.store(false, std::memory_order_relaxed);
+			stopping = stop;
+			flush_target = flush_requested;
+			local_rings = rings;
+		}
+		
+		// 1. Drain and format everything that's been published so far
+		for (auto &ring : local_rings) {
+			size_t head = ring->head.load(std::memory_order_relaxed);
+			size_t tail = ring->tail.load(std::memory_order_acquire);
+			for (; head != tail; ++head) {
+				const LogSlot &slot = ring->slots[head & ring->mask];
+				switch (slot.kind) {
+				case LogSlot::Kind::TEXT: {
+					message.assign(slot.text, slot.len);
+				} break;
+				case LogSlot::Kind::TEXT_CONTINUED: {
+					message.append(slot.text, slot.len);
+				} break;
+				case LogSlot::Kind::ACCESS: {
+					char buf[LogSlot::TEXT_SIZE + 64];
+					int len = snprintf(buf, sizeof(buf), "%s %.*s %d %llu %.3fms",
+						METHOD_NAMES[int(slot.access.method)],
+						int(slot.len), slot.access.target,
+						slot.access.status,
+						(unsigned long long) slot.access.bytes,
+						slot.access.latency_ns / 1e6
+					);
+					deliver(slot.level, buf, std::min<size_t>(len, sizeof(buf) - 1));
+				} continue;
+				}
+				// A multi-slot message is always published at once, so it's complete when the next
+				// slot isn't its continuation
+				if (head + 1 == tail || ring->slots[(head + 1) & ring->mask].kind != LogSlot::Kind::TEXT_CONTINUED) {
+					deliver(slot.level, message.data(), message.size());
+				}
+			}
+			ring->head.store(tail, std::memory_order_release);
+		}
+		
+		uint64_t total_dropped = dropped.load(std::memory_order_relaxed);
+		if (total_dropped != reported_dropped) {
+			std::string s = "Async logger dropped " + std::to_string(total_dropped - reported_dropped) + " messages";
+			deliver(LogLevel::WARN, s.data(), s.size());
+			reported_dropped = total_dropped;
+		}
+		
+		// 2. Flush the batch with a single write
+		if (!batch.empty()) {
+			fwrite(batch.data(), 1, batch.size(), stdout);
+			fflush(stdout);
+			batch.clear();
+		}
+		
+		// 3. Forget about rings of threads that have exited, once they're empty
+		local_rings.clear();
+		{
+			std::lock_guard lock(mutex);
+			std::erase_if(rings, [](const std::shared_ptr<LogRing> &ring) {
+				if (ring.use_count() != 1) return false;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				return ring->head.load(std::memory_order_relaxed) == ring->tail.load(std::memory_order_acquire);
+			});
+			flush_done = flush_target;
+		}
+		flushed_cv.notify_all();
+		
+		if (stopping) break;
+	}
+}
+
+AsyncLogger::AsyncLogger(size_t capacity, LogOverflow overflow, const LogHandler &sink)
+:
+	m(std::make_shared<AsyncLogState>(capacity, overflow, sink))
+{}
+
+AsyncLogger &
+AsyncLogger::flush_interval(std::chrono::milliseconds interval)
+{
+	m->interval_ms = interval.count();
+	return *this;
+}
+
+void
+AsyncLogger::operator()(LogLevel level, const char *str, size_t len) const
+{
+	LogRing &ring = m->ring();
+	size_t n = std::max<size_t>(1, (len + LogSlot::TEXT_SIZE - 1) / LogSlot::TEXT_SIZE);
+	size_t tail;
+	if (!m->acquire(ring, n, tail)) return;
+	for (size_t i = 0; i < n; ++i) {
+		LogSlot &slot = ring.slots[(tail + i) & ring.mask];
+		size_t chunk = std::min(len, LogSlot::TEXT_SIZE);
+		slot.kind = i == 0 ? LogSlot::Kind::TEXT : LogSlot::Kind::TEXT_CONTINUED;
+		slot.level = level;
+		slot.len = chunk;
+		memcpy(slot.text, str, chunk);
+		str += chunk;
+		len -= chunk;
+	}
+	m->publish(ring, tail + n);
+}
+
+void
+AsyncLogger::access(Method method, std::string_view target, int status, uint64_t bytes, std::chrono::nanoseconds latency) const
+{
+	LogRing &ring = m->ring();
+	size_t tail;
+	if (!m->acquire(ring, 1, tail)) return;
+	LogSlot &slot = ring.slots[tail & ring.mask];
+	slot.kind = LogSlot::Kind::ACCESS;
+	slot.level = LogLevel::INFO;
+	slot.len = std::min(target.size(), sizeof(slot.access.target));
+	slot.access.method = method;
+	slot.access.status = status;
+	slot.access.bytes = bytes;
+	slot.access.latency_ns = latency.count();
+	memcpy(slot.access.target, target.data(), slot.len);
+	m->publish(ring, tail + 1);
+}
+
+void
+AsyncLogger::flush() const
+{
+	std::unique_lock lock(m->mutex);
+	uint64_t target = ++m->flush_requested;
+	m->cv.notify_one();
+	m->flushed_cv.wait(lock, [this, target] { return m->flush_done >= target; });
+}
+
+uint64_t
+AsyncLogger::dropped() const
+{
+	return m->dropped.load(std::memory_order_relaxed);
+}
+
+}
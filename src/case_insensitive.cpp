@@ -1,24 +1,109 @@
 #include <woof/woof.hpp>
-#include <cctype>
+#include <bit>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace woof {
 
-// Hash with 64bit FNV1a
-size_t CaseInsensitiveHash::operator()(const std::string &s) const {
-	uint64_t hash = 0xcbf29ce484222325;
-	const uint64_t prime = 0x100000001b3;
-	for (char c : s) {
-		hash ^= std::toupper(c);
-		hash *= prime;
+// Header names are compared ASCII case-insensitively (RFC 9110 section 5.1), so instead of
+// std::toupper we fold 'A'-'Z' to lowercase 8 bytes at a time with SWAR, or 16 at a time with SSE2.
+// Bytes outside of ASCII are left alone.
+
+static constexpr uint64_t ONES = 0x0101010101010101;
+static constexpr uint64_t HIGH = 0x8080808080808080;
+
+static inline uint64_t
+fold(uint64_t x) noexcept
+{
+	uint64_t heptets = x & ~HIGH;
+	uint64_t ge_a = heptets + (0x80 - 'A') * ONES;
+	uint64_t gt_z = heptets + (0x80 - 'Z' - 1) * ONES;
+	uint64_t upper = ge_a & ~gt_z & ~x & HIGH;
+	return x | (upper >> 2);
+}
+
+static inline uint64_t
+load64(const char *p) noexcept
+{
+	uint64_t x;
+	memcpy(&x, p, 8);
+	return x;
+}
+
+// Loads the last 1 to 7 bytes of a string, overlapping reads as needed. Equal strings of equal
+// length always give equal words, which is all the hash and the comparison need.
+static inline uint64_t
+load_tail(const char *p, size_t n) noexcept
+{
+	if (n >= 4) {
+		uint32_t lo, hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + n - 4, 4);
+		return uint64_t(hi) << 32 | lo;
 	}
-	return hash;
+	return uint64_t(uint8_t(p[0])) | uint64_t(uint8_t(p[n / 2])) << 8 | uint64_t(uint8_t(p[n - 1])) << 16;
+}
+
+static inline uint64_t
+mix(uint64_t h, uint64_t word) noexcept
+{
+	h = (h ^ word) * 0x9e3779b97f4a7c15;
+	return h ^ (h >> 32);
 }
 
-bool CaseInsensitiveEquals::operator()(const std::string &a, const std::string &b) const {
-	size_t len = a.size();
-	if (len != b.size()) return false;
-	for (size_t i = 0; i < len; ++i) {
-		if (std::toupper(a[i]) != std::toupper(b[i])) return false;
+#if defined(__SSE2__)
+static inline __m128i
+fold(__m128i x) noexcept
+{
+	__m128i ge_a = _mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1));
+	__m128i le_z = _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1));
+	return _mm_or_si128(x, _mm_and_si128(_mm_and_si128(ge_a, le_z), _mm_set1_epi8(0x20)));
+}
+#endif
+
+size_t
+CaseInsensitiveHash::operator()(std::string_view s) const noexcept
+{
+	const char *p = s.data();
+	size_t n = s.size();
+	uint64_t h = 0xcbf29ce484222325 ^ n;
+#if defined(__SSE2__)
+	for (; n >= 16; p += 16, n -= 16) {
+		__m128i x = fold(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+		h = mix(h, uint64_t(_mm_cvtsi128_si64(x)));
+		h = mix(h, uint64_t(_mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x))));
+	}
+#endif
+	for (; n >= 8; p += 8, n -= 8) {
+		h = mix(h, fold(load64(p)));
+	}
+	if (n > 0) {
+		h = mix(h, fold(load_tail(p, n)));
+	}
+	return h;
+}
+
+bool
+CaseInsensitiveEquals::operator()(std::string_view a, std::string_view b) const noexcept
+{
+	size_t n = a.size();
+	if (n != b.size()) return false;
+	const char *p = a.data();
+	const char *q = b.data();
+#if defined(__SSE2__)
+	for (; n >= 16; p += 16, q += 16, n -= 16) {
+		__m128i x = fold(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+		__m128i y = fold(_mm_loadu_si128(reinterpret_cast<const __m128i *>(q)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff) return false;
+	}
+#endif
+	for (; n >= 8; p += 8, q += 8, n -= 8) {
+		if (fold(load64(p)) != fold(load64(q))) return false;
+	}
+	if (n > 0) {
+		return fold(load_tail(p, n)) == fold(load_tail(q, n));
 	}
 	return true;
 }
@@ -0,0 +1,32 @@
+#include "internal.hpp"
+
+namespace woof {
+
+void
+Server::coalesce(const PathPattern &path, const std::vector<std::string> &vary, std::chrono::milliseconds timeout)
+{
+	m->coalesce.push_back({path, vary, timeout});
+}
+
+Flight::~Flight()
+{
+	if (!completed) complete(prepared_bytes(m, find_error_response(m, 500), head_request));
+}
+
+void
+Flight::complete(std::shared_ptr<const std::string> bytes)
+{
+	std::vector<std::function<void(std::shared_ptr<const std::string>)>> waiters;
+	{
+		std::lock_guard lock(m.flights_mutex);
+		auto it = m.flights.find(key);
+		waiters = std::move(it->second);
+		m.flights.erase(it);
+	}
+	completed = true;
+	for (auto &waiter : waiters) {
+		waiter(bytes);
+	}
+}
+
+}
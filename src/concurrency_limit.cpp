@@ -0,0 +1,129 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace woof {
+
+ConcurrencyLimiterState::ConcurrencyLimiterState(int initial, int min, int max)
+:
+	min_limit(std::max(min, 1)),
+	max_limit(std::max(max, min_limit)),
+	limit(std::clamp(initial, min_limit, max_limit)),
+	estimate(limit)
+{}
+
+int
+ConcurrencyLimiterState::acquire()
+{
+	int n = in_flight.fetch_add(1, std::memory_order_acq_rel) + 1;
+	if (n > limit.load(std::memory_order_relaxed)) {
+		in_flight.fetch_sub(1, std::memory_order_acq_rel);
+		rejected.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	return n;
+}
+
+void
+ConcurrencyLimiterState::release()
+{
+	in_flight.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void
+ConcurrencyLimiterState::sample(std::chrono::steady_clock::duration latency, int n)
+{
+	std::lock_guard lock(mutex);
+	window_latency += std::chrono::duration<double, std::micro>(latency).count();
+	window_max_in_flight = std::max(window_max_in_flight, n);
+	if (++window_size < WINDOW) return;
+	
+	double short_latency = window_latency / window_size;
+	bool app_limited = window_max_in_flight < estimate / 2;
+	window_latency = 0;
+	window_size = 0;
+	window_max_in_flight = 0;
+	
+	if (long_latency == 0) {
+		long_latency = short_latency;
+	} else {
+		long_latency += (short_latency - long_latency) / LONG_WINDOW;
+		// Latency went down a lot, e.g. after an overload, so don't wait for the average to catch up
+		if (long_latency > 2 * short_latency) long_latency *= 0.95;
+	}
+	// Nothing is known about latency near the limit if the requests don't get near it
+	if (app_limited) return;
+	
+	double gradient = std::clamp(TOLERANCE * long_latency / std::max(short_latency, 1.0), 0.5, 1.0);
+	double next = estimate * gradient + std::sqrt(estimate);
+	estimate = std::clamp(estimate * (1 - SMOOTHING) + next * SMOOTHING, double(min_limit), double(max_limit));
+	limit.store(int(estimate), std::memory_order_relaxed);
+}
+
+Admission::~Admission()
+{
+	if (limiter) {
+		if (is_done) limiter->sample(latency, in_flight);
+		limiter->release();
+	}
+	for (Bulkhead *bulkhead : bulkheads) {
+		bulkhead->in_flight.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+bool
+Admission::enter(ConcurrencyLimiterState &limiter_)
+{
+	in_flight = limiter_.acquire();
+	if (!in_flight) return false;
+	limiter = &limiter_;
+	return true;
+}
+
+bool
+Admission::enter(Bulkhead &bulkhead)
+{
+	if (bulkhead.in_flight.fetch_add(1, std::memory_order_acq_rel) >= bulkhead.max_in_flight) {
+		bulkhead.in_flight.fetch_sub(1, std::memory_order_acq_rel);
+		return false;
+	}
+	bulkheads.push_back(&bulkhead);
+	return true;
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(int initial, int min, int max)
+:
+	m(std::make_shared<ConcurrencyLimiterState>(initial, min, max))
+{}
+
+int
+ConcurrencyLimiter::limit() const
+{
+	return m->limit.load(std::memory_order_relaxed);
+}
+
+int
+ConcurrencyLimiter::in_flight() const
+{
+	return m->in_flight.load(std::memory_order_relaxed);
+}
+
+uint64_t
+ConcurrencyLimiter::rejected() const
+{
+	return m->rejected.load(std::memory_order_relaxed);
+}
+
+void
+Server::concurrency_limit(const ConcurrencyLimiter &limiter)
+{
+	m->concurrency_limiter = limiter.m;
+}
+
+void
+Server::bulkhead(int max_in_flight, const PathPattern &path)
+{
+	m->bulkheads.emplace_back(path, std::make_shared<Bulkhead>(max_in_flight));
+}
+
+}
@@ -0,0 +1,767 @@
+#ifndef _WOOF_connection_hpp
+#define _WOOF_connection_hpp
+
+#include "internal.hpp"
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast.hpp>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+
+namespace woof {
+
+inline constexpr Method
+http_method(http::verb verb)
+{
+	switch (verb) {
+		case http::verb::get:     return Method::GET;
+		case http::verb::head:    return Method::HEAD;
+		case http::verb::post:    return Method::POST;
+		case http::verb::put:     return Method::PUT;
+		case http::verb::delete_: return Method::DELETE;
+		case http::verb::connect: return Method::CONNECT;
+		case http::verb::options: return Method::OPTIONS;
+		case http::verb::trace:   return Method::TRACE;
+		case http::verb::patch:   return Method::PATCH;
+		default: return Method::UNKNOWN;
+	}
+}
+
+inline std::string
+serialize(http::response<http::string_body> &response)
+{
+	std::string bytes;
+	beast::error_code ec;
+	http::response_serializer<http::string_body> sr(response);
+	while (!sr.is_done()) {
+		sr.next(ec, [&](beast::error_code &, const auto &buffers) {
+			for (auto buffer : beast::buffers_range_ref(buffers)) {
+				bytes.append(static_cast<const char *>(buffer.data()), buffer.size());
+			}
+			sr.consume(beast::buffer_bytes(buffers));
+		});
+	}
+	return bytes;
+}
+
+// Identifies a request for the response cache and for coalescing
+template<class Head>
+std::string
+request_key(Method method, const std::string &target, const std::vector<std::string> &vary, const Head &head)
+{
+	std::string key;
+	key.push_back(char(method));
+	key.append(target);
+	for (auto &name : vary) {
+		key.push_back('\0');
+		key.append(head[name]);
+	}
+	return key;
+}
+
+// Closes the connection. A TLS stream sends close_notify first, and waits for the client's reply
+// asynchronously rather than on the worker.
+template<class Stream>
+void
+close_stream(Stream &stream)
+{
+	if constexpr (requires { stream.async_shutdown([](beast::error_code) {}); }) {
+		auto s = std::make_shared<Stream>(std::move(stream));
+		beast::get_lowest_layer(*s).expires_after(std::chrono::seconds(5));
+		s->async_shutdown([s](beast::error_code) {
+			beast::get_lowest_layer(*s).close();
+		});
+	} else {
+		stream.close();
+	}
+}
+
+// For SocketOptions::cork. Fails quietly on sockets other than TCP ones.
+template<class Stream>
+void
+set_cork(Stream &stream, bool cork)
+{
+#ifdef TCP_CORK
+	if constexpr (requires { beast::get_lowest_layer(stream).socket().native_handle(); }) {
+		int value = cork;
+		::setsockopt(beast::get_lowest_layer(stream).socket().native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+	}
+#endif
+}
+
+// A serialized response as a PreparedResponse, split before the empty line
+inline std::shared_ptr<const PreparedResponse>
+split_response(const std::string &bytes)
+{
+	auto prepared = std::make_shared<PreparedResponse>();
+	size_t end = bytes.find("\r\n\r\n") + 2;
+	prepared->head = bytes.substr(0, end);
+	prepared->tail = bytes.substr(end);
+	return prepared;
+}
+
+// The Date field, and the Server field if there's one. Like in PreparedResponse, they're cut out of
+// preformatted fields.
+template<class Message>
+void
+set_date_server(const ServerState &m, Message &message)
+{
+	std::string_view date = date_field();
+	message.set(http::field::date, date.substr(6, date.size() - 8));
+	if (!m.server_field.empty()) {
+		message.set(http::field::server, std::string_view(m.server_field).substr(8, m.server_field.size() - 10));
+	}
+}
+
+// "Allow: GET, HEAD\r\n" for RouteMatch::allowed
+inline std::string
+allow_field(uint16_t allowed)
+{
+	std::string field = "Allow:";
+	for (int i = 1; i < int(std::size(METHOD_NAMES)); ++i) {
+		if (!(allowed & (1 << i))) continue;
+		field.append(field.size() > 6 ? ", " : " ").append(METHOD_NAMES[i]);
+	}
+	return field.append("\r\n");
+}
+
+// Writes the response as it was serialized, with the Date and Server fields and any `extra` ones
+template<class Stream>
+void
+write_prepared(const ServerState &m, Stream &stream, const PreparedResponse &response, bool head_request, std::string_view extra = {})
+{
+	std::array<beast::net::const_buffer, 5> buffers {
+		beast::net::buffer(response.head),
+		beast::net::buffer(extra),
+		beast::net::buffer(date_field()),
+		beast::net::buffer(m.server_field),
+		beast::net::buffer(head_request ? std::string_view(response.tail).substr(0, 2) : std::string_view(response.tail)),
+	};
+	beast::net::write(stream, buffers);
+}
+
+// For HTTP/2, which can't use the serialized form
+inline http::response<http::string_body>
+unprepared_response(const ServerState &m, const FixedResponse &fixed)
+{
+	http::response<http::string_body> response;
+	response.version(11);
+	response.result(fixed.status.code);
+	if (!fixed.content_type.empty()) response.set(http::field::content_type, fixed.content_type);
+	for (auto &[name, value] : fixed.headers) response.insert(name, value);
+	set_date_server(m, response);
+	response.body() = fixed.body;
+	response.prepare_payload();
+	return response;
+}
+
+// The steps of handling a request that don't depend on the protocol, shared by HTTP/1 and HTTP/2
+
+// Returns false if the target is invalid
+inline bool
+load_target(ConnectionState &state, std::string_view target)
+{
+	state.target_string_raw = target;
+	state.target = ParsedTarget(state.target_string_raw);
+	if (!state.target.success) return false;
+	state.path_string_raw = state.target.path_raw;
+	state.query_string_raw = state.target.query_raw;
+	// TODO: handling trailing slash quirks all around the library
+	if (state.target.path_segments.back().empty()) state.target.path_segments.pop_back();
+	return true;
+}
+
+// Returns nullptr if there's no handler, with the status to respond with. For 405, `allowed` are
+// the methods the path has routes for.
+inline const RouterNode::Handler *
+route_request(ServerState &m, ConnectionState &state, Status &status, uint16_t &allowed)
+{
+	RouteMatch match;
+	std::shared_ptr<RouterNode> node = dfs_route(match, state.method, m.router, state.target.path_segments, 0);
+	if (!node) {
+		// Handler not found => 404, 405 if there are routes for the path but not the method, or 400
+		// if the only matching routes had typed params that didn't convert
+		status = match.rejected ? 400 : match.allowed ? 405 : 404;
+		allowed = match.allowed;
+		return nullptr;
+	}
+	state.param_values = std::move(match.param_values);
+	return &(match.globstar ? node->globstar_handlers : node->handlers)[state.method];
+}
+
+// Returns false if a rate limiter matching the request is out of tokens
+template<class Head>
+bool
+take_rate_limits(ServerState &m, const ConnectionState &state, const Head &head, std::chrono::seconds &retry_after)
+{
+	for (auto &[path, limiter] : m.rate_limits) {
+		if (!match_pattern(path, state.target.path_segments)) continue;
+		std::string_view header;
+		if (!limiter->key_header.empty()) header = head[limiter->key_header];
+		uint64_t key = rate_limit_key(!header.empty() ? header : std::string_view(
+			reinterpret_cast<const char *>(state.remote_ip.data()), state.remote_ip.size()
+		));
+		if (!limiter->take(key, retry_after)) return false;
+	}
+	return true;
+}
+
+// Takes the request's slots in the concurrency limiter and the bulkheads. Returns false if it's over
+// any of their limits.
+inline bool
+admit(ServerState &m, const ConnectionState &state, Admission &admission)
+{
+	if (m.concurrency_limiter && !admission.enter(*m.concurrency_limiter)) return false;
+	for (auto &[path, bulkhead] : m.bulkheads) {
+		if (match_pattern(path, state.target.path_segments) && !admission.enter(*bulkhead)) return false;
+	}
+	return true;
+}
+
+// Query params and request headers
+template<class Head>
+void
+load_head(ConnectionState &state, const Head &head)
+{
+	for (auto &p : state.target.query_params) {
+		state.query_params.emplace(std::move(p.first), std::move(p.second));
+	}
+	for (auto &field : head) {
+		auto it = state.headers.emplace(field.name_string(), field.value());
+		Field f = field_from_beast(unsigned(field.name()));
+		if (f != Field::UNKNOWN && !state.header_index[size_t(f)]) {
+			state.header_index[size_t(f)] = &it->second;
+		}
+	}
+}
+
+// Calls the middlewares and the endpoint handler
+inline void
+call_handler(ServerState &m, std::shared_ptr<ConnectionState> state, const RouterNode::Handler &handler)
+{
+	auto start = std::chrono::steady_clock::now();
+	
+	// 1. Resolve the list of middlewares in correct order
+	std::vector<std::pair<size_t, ServerState::MiddlewareConfig *>> mw_list;
+	resolve_middlewares(m, state->target.path_segments, mw_list);
+	
+	Request request(state);
+	Response response(state);
+	
+	// 2. Instantiate the middlewares. Path params are views of the path segments, so only the list
+	// of param names changes between calls.
+	std::vector<std::pair<MiddlewareI *, const std::vector<PathParam> *>> mws;
+	mws.reserve(mw_list.size());
+	for (auto &[hash, mwc] : mw_list) {
+		MiddlewareI *mw = mwc->creator();
+		state->mw_map[hash] = mw;
+		mws.emplace_back(mw, &mwc->path_params);
+	}
+	
+	// 3. Call MiddlewareI::before on middlewares
+	for (auto &mw : mws) {
+		state->path_params = mw.second;
+		mw.first->before(request, response);
+	}
+	
+	// 4. Call the endpoint handler
+	try {
+		state->path_params = &handler.path_params;
+		handler.handler(request, response);
+	} catch (const JsonError &e) {
+		// Whatever the handler wrote before is dropped
+		state->status_code = e.status;
+		state->response_body_stream.str({});
+	} catch (...) {
+		// TODO: handle endpoint handler exception
+	}
+	
+	// 5. Call MiddlewareI::after on middlewares
+	for (auto it = mws.rbegin(); it != mws.rend(); ++it) {
+		state->path_params = it->second;
+		it->first->after(request, response);
+	}
+	
+	// 6. Delete middlewares
+	for (auto [hash, mw] : state->mw_map) {
+		delete mw;
+	}
+	
+	// 7. Access log
+	if (m.access_log && match_pattern(m.access_log->first, state->target.path_segments)) {
+		std::streamoff bytes = state->response_body_stream.tellp();
+		m.access_log->second.access(
+			state->method,
+			state->target_string_raw,
+			state->status_code.code,
+			bytes > 0 ? bytes : 0,
+			std::chrono::steady_clock::now() - start
+		);
+	}
+}
+
+inline http::response<http::string_body>
+make_response(const ServerState &m, ConnectionState &state)
+{
+	http::response<http::string_body> beast_response;
+	beast_response.version(11);
+	beast_response.result(state.status_code);
+	set_date_server(m, beast_response);
+	beast_response.body() = std::move(state.response_body_stream).str();
+	
+	for (size_t i = 1; i < size_t(Field::COUNT); ++i) {
+		if (state.response_fields_set[i]) {
+			beast_response.set(http::field(beast_field(Field(i))), std::move(state.response_fields[i]));
+		}
+	}
+	for (auto &[name, value] : state.response_headers) {
+		// A field set with Response::header replaces these
+		Field field = field_from_name(name);
+		if (field != Field::UNKNOWN && state.response_fields_set[size_t(field)]) continue;
+		beast_response.insert(name, value);
+	}
+	// Plain text, unless the handler said otherwise or there's nothing to describe
+	if (!beast_response.body().empty() && !state.response_fields_set[size_t(Field::CONTENT_TYPE)]
+		&& beast_response.find(http::field::content_type) == beast_response.end()) {
+		beast_response.set(http::field::content_type, "text/plain; charset=utf-8");
+	}
+	
+	beast_response.prepare_payload();
+	return beast_response;
+}
+
+// Of a request body that isn't multipart, Beast's default
+inline constexpr uint64_t BODY_LIMIT = 1 << 20;
+
+inline constexpr std::string_view HTTP2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Defined in http2.hpp. Like start_websocket, it takes over the stream, the buffer and the slot and
+// returns. `preface` is what's left to read of the client connection preface, and `upgrade` is the
+// request that asked for h2c, if any, which becomes stream 1.
+template<class Stream>
+void handle_http2(
+	std::shared_ptr<ServerState> m,
+	Stream &stream,
+	beast::flat_buffer &buffer,
+	std::shared_ptr<const ConnectionState> connection,
+	std::string_view preface,
+	bool expired,
+	std::shared_ptr<ConnectionSlot> slot,
+	http::request<http::string_body> *upgrade
+);
+
+// Defined in websocket.hpp. Takes over the stream and returns, the connection then runs
+// asynchronously. It keeps the slot, so that it still counts towards the connection cap.
+template<class Stream>
+void start_websocket(
+	std::shared_ptr<const ServerState> m,
+	std::shared_ptr<ConnectionState> state,
+	std::shared_ptr<const WebSocketHandlers> handlers,
+	Stream &stream,
+	std::shared_ptr<ConnectionSlot> slot,
+	http::request<http::string_body> upgrade
+);
+
+// Defined in event_stream.hpp, and like start_websocket
+template<class Stream>
+void start_event_stream(
+	std::shared_ptr<EventChannelState> channel,
+	Stream &stream,
+	std::shared_ptr<ConnectionSlot> slot,
+	std::shared_ptr<const std::string> head,
+	std::optional<uint64_t> last_id
+);
+
+// Reads until the buffer either starts with the HTTP/2 client connection preface, or can't anymore.
+// No HTTP/1 request starts with "PRI", so they're told apart after the first read.
+template<class Stream>
+bool
+read_http2_preface(Stream &stream, beast::flat_buffer &buffer)
+{
+	for (;;) {
+		std::string_view data(static_cast<const char *>(buffer.data().data()), buffer.size());
+		size_t n = std::min(data.size(), HTTP2_PREFACE.size());
+		if (data.substr(0, n) != HTTP2_PREFACE.substr(0, n)) return false;
+		if (n == HTTP2_PREFACE.size()) return true;
+		buffer.commit(stream.read_some(buffer.prepare(4096)));
+	}
+}
+
+// Whether the request asks to upgrade to HTTP/2 over cleartext TCP, RFC 7540 3.2
+template<class Head>
+bool
+wants_h2c(const Head &head)
+{
+	if (head.find(http::field::http2_settings) == head.end()) return false;
+	for (auto token : http::token_list(head[http::field::upgrade])) {
+		if (beast::iequals(token, "h2c")) return true;
+	}
+	return false;
+}
+
+// Whether a request's Authorization and Cookie headers, if it has them, are among the `vary` headers
+// of a coalesced route, so that requests with different credentials don't share a response
+template<class Head>
+bool
+varies_on_credentials(const Head &head, const std::vector<std::string> &vary)
+{
+	auto in_vary = [&vary](std::string_view name) {
+		for (auto &v : vary) {
+			if (beast::iequals(v, name)) return true;
+		}
+		return false;
+	};
+	return (head.find(http::field::authorization) == head.end() || in_vary("Authorization"))
+		&& (head.find(http::field::cookie) == head.end() || in_vary("Cookie"));
+}
+
+// A coalesced request waiting for the leader's response. Its timer and the leader's response are
+// handled on a strand, and whichever comes first is written.
+template<class Stream>
+struct Follower {
+	Stream stream;
+	std::shared_ptr<ConnectionSlot> slot;
+	boost::asio::steady_timer timer;
+	bool done = false;
+	
+	Follower(Stream &&stream_, std::shared_ptr<ConnectionSlot> slot_) :
+		stream(std::move(stream_)),
+		slot(std::move(slot_)),
+		timer(boost::asio::make_strand(stream.get_executor()))
+	{}
+	
+	void
+	write(std::shared_ptr<Follower> self, std::shared_ptr<const std::string> bytes)
+	{
+		if (done) return;
+		done = true;
+		timer.cancel();
+		beast::net::async_write(stream, beast::net::buffer(*bytes), [self, bytes](beast::error_code, size_t) {
+			close_stream(self->stream);
+			self->slot.reset();
+		});
+	}
+};
+
+// Takes over the stream, and returns the callback that gets the leader's response. Past the
+// timeout, the request gets a 503 instead.
+template<class Stream>
+std::function<void(std::shared_ptr<const std::string>)>
+follow(std::shared_ptr<ServerState> m, Stream &stream, std::shared_ptr<ConnectionSlot> slot, bool head_request, std::chrono::milliseconds timeout)
+{
+	auto follower = std::make_shared<Follower<Stream>>(std::move(stream), std::move(slot));
+	follower->timer.expires_after(timeout);
+	follower->timer.async_wait([follower, m, head_request](beast::error_code ec) {
+		if (!ec) follower->write(follower, prepared_bytes(*m, find_error_response(*m, 503), head_request));
+	});
+	return [follower](std::shared_ptr<const std::string> bytes) {
+		boost::asio::post(follower->timer.get_executor(), [follower, bytes] {
+			follower->write(follower, bytes);
+		});
+	};
+}
+
+// `accepted` is when the connection was accepted, for the queue deadline, and `slot` counts it
+// towards the connection cap
+template<class Stream>
+void
+handle_connection(
+	std::shared_ptr<ServerState> m,
+	Stream &stream,
+	std::chrono::steady_clock::time_point accepted = {},
+	std::shared_ptr<ConnectionSlot> slot = {}
+)
+{ // TODO: general error handling here
+	bool expired = m->queue_deadline.count() > 0 && accepted != std::chrono::steady_clock::time_point()
+		&& std::chrono::steady_clock::now() - accepted > m->queue_deadline;
+	beast::flat_buffer buffer;
+	
+	auto state = std::make_shared<ConnectionState>();
+	state->status_code = 200;
+	
+	if constexpr (requires { beast::get_lowest_layer(stream).socket().remote_endpoint().address(); }) {
+		beast::error_code ec;
+		auto endpoint = beast::get_lowest_layer(stream).socket().remote_endpoint(ec);
+		if (!ec) {
+			auto address = endpoint.address();
+			state->has_remote = true;
+			state->remote_ip = address.is_v4()
+				? boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, address.to_v4()).to_bytes()
+				: address.to_v6().to_bytes();
+			state->remote_port = endpoint.port();
+		}
+	}
+	
+	// The server's own responses are written from their serialized form. Coalesced requests waiting
+	// on this one get the same.
+	std::optional<Flight> flight;
+	auto respond = [&m, &stream, &state, &flight](Status status, std::string_view extra = {}) {
+		auto &response = find_error_response(*m, status.code);
+		bool head_request = state->method == Method::HEAD;
+		if (flight) flight->complete(prepared_bytes(*m, response, head_request, extra));
+		write_prepared(*m, stream, response, head_request, extra);
+		close_stream(stream);
+	};
+	
+	// 1. Request head, unless it's HTTP/2 with prior knowledge
+	// TODO: request size limits
+	if (read_http2_preface(stream, buffer)) {
+		if (slot) slot->active();
+		handle_http2(m, stream, buffer, state, HTTP2_PREFACE, expired, std::move(slot), nullptr);
+		return;
+	}
+	http::request_parser<http::empty_body> head_parser;
+	// The body's limit depends on the route, see 2.
+	head_parser.body_limit(std::numeric_limits<uint64_t>::max());
+	http::read_header(stream, buffer, head_parser);
+	auto &head = head_parser.get();
+	if (slot) slot->active();
+	
+	// 1.1. An h2c upgrade request is answered with 101, and becomes the first stream of an HTTP/2
+	// connection
+	if (wants_h2c(head)) {
+		http::request_parser<http::string_body> parser(std::move(head_parser));
+		parser.body_limit(BODY_LIMIT);
+		http::read(stream, buffer, parser);
+		auto upgrade = parser.release();
+		http::response<http::empty_body> switching(http::status::switching_protocols, 11);
+		switching.set(http::field::connection, "Upgrade");
+		switching.set(http::field::upgrade, "h2c");
+		http::write(stream, switching);
+		handle_http2(m, stream, buffer, state, HTTP2_PREFACE, expired, std::move(slot), &upgrade);
+		return;
+	}
+	
+	// 1.2. Request method
+	state->method = http_method(head.method());
+	
+	// 1.3. Parse the target string
+	if (!load_target(*state, head.target())) {
+		// Invalid target string => 400
+		respond(400);
+		return;
+	}
+	
+	// 1.4. Route the request
+	Status status;
+	uint16_t allowed;
+	const RouterNode::Handler *handler = route_request(*m, *state, status, allowed);
+	if (!handler) {
+		respond(status, status.code == 405 ? allow_field(allowed) : std::string());
+		return;
+	}
+	if (handler->fixed) {
+		write_prepared(*m, stream, *handler->fixed, state->method == Method::HEAD);
+		close_stream(stream);
+		return;
+	}
+	
+	// 1.5. Rate limits
+	std::chrono::seconds retry_after;
+	if (!take_rate_limits(*m, *state, head, retry_after)) {
+		http::response<http::empty_body> beast_response;
+		beast_response.version(11);
+		beast_response.result(429);
+		set_date_server(*m, beast_response);
+		beast_response.set(http::field::retry_after, std::to_string(retry_after.count()));
+		beast_response.prepare_payload();
+		http::write(stream, beast_response);
+		close_stream(stream);
+		return;
+	}
+	
+	// 1.6. Serve hits from the response cache
+	ResponseCacheState *cache = nullptr;
+	std::string cache_key;
+	bool upgrade = beast::websocket::is_upgrade(head);
+	if ((state->method == Method::GET || state->method == Method::HEAD) && !upgrade) {
+		for (auto &[path, c] : m->caches) {
+			if (match_pattern(path, state->target.path_segments)) {
+				cache = c.get();
+				break;
+			}
+		}
+	}
+	// Requests with credentials aren't served from the cache, so that they go through the
+	// middlewares. The request's Cache-Control can also ask for a fresh response, or for it not to be
+	// stored.
+	bool authorization = head.find(http::field::authorization) != head.end();
+	if (cache) {
+		bool serve, store;
+		ResponseCacheState::request_directives(head[http::field::cache_control], serve, store);
+		cache_key = request_key(state->method, state->target.decoded, cache->vary, head);
+		auto response = serve && !authorization ? cache->find(cache_key) : nullptr;
+		if (response) {
+			write_prepared(*m, stream, *response, state->method == Method::HEAD);
+			close_stream(stream);
+			return;
+		}
+		if (!store) cache = nullptr;
+	}
+	
+	// 1.7. Shed load: past the queue deadline, over the concurrency limit or a bulkhead's => 503
+	Admission admission;
+	if (expired || !admit(*m, *state, admission)) {
+		respond(503);
+		return;
+	}
+	
+	// 1.8. Coalesce identical requests. A request that isn't first hands its stream over to a
+	// follower, which writes the leader's response asynchronously, and gives the worker back.
+	// Requests that keep the connection or have a body aren't identical to anything, and neither
+	// are ones with credentials, unless they're part of the key.
+	bool has_body = head_parser.chunked() || head_parser.content_length().value_or(0) > 0;
+	if ((state->method == Method::GET || state->method == Method::HEAD) && !upgrade && !has_body && !handler->takes_over) {
+		for (auto &config : m->coalesce) {
+			if (!match_pattern(config.path, state->target.path_segments)) continue;
+			if (!varies_on_credentials(head, config.vary)) break;
+			std::string key = request_key(state->method, state->target.decoded, config.vary, head);
+			std::lock_guard lock(m->flights_mutex);
+			auto [it, leader] = m->flights.try_emplace(key);
+			if (!leader) {
+				it->second.push_back(follow(m, stream, std::move(slot), state->method == Method::HEAD, config.timeout));
+				return;
+			}
+			flight.emplace(*m, std::move(key), state->method == Method::HEAD);
+			break;
+		}
+	}
+	
+	// 1.9. Query params and request headers
+	load_head(*state, head);
+	
+	// 2. Request body
+	http::request<http::string_body> full_request;
+	std::string boundary;
+	const MultipartConfig *config = find_multipart(*m, *state, boundary);
+	uint64_t body_limit = config ? config->max_size : BODY_LIMIT;
+	if (head_parser.content_length().value_or(0) > body_limit) {
+		respond(413);
+		return;
+	}
+	if (config) {
+		// 2.1. A multipart body is parsed into parts a chunk at a time, as it's read
+		http::request_parser<http::buffer_body> parser(std::move(head_parser));
+		parser.body_limit(body_limit);
+		MultipartParser multipart(*config, boundary, state->parts);
+		char chunk[16 << 10];
+		while (!parser.is_done()) {
+			parser.get().body().data = chunk;
+			parser.get().body().size = sizeof(chunk);
+			beast::error_code ec;
+			http::read(stream, buffer, parser, ec);
+			if (ec == http::error::need_buffer) ec = {};
+			if (ec == http::error::body_limit) {
+				respond(413);
+				return;
+			}
+			if (ec) throw beast::system_error(ec);
+			if (!multipart.feed(chunk, sizeof(chunk) - parser.get().body().size)) {
+				respond(multipart.error);
+				return;
+			}
+		}
+		if (!multipart.finish()) {
+			respond(multipart.error);
+			return;
+		}
+		full_request = http::request<http::string_body>(parser.release().base());
+	} else {
+		// 2.2. Anything else is read whole
+		http::request_parser<http::string_body> parser(std::move(head_parser));
+		parser.body_limit(body_limit);
+		beast::error_code ec;
+		http::read(stream, buffer, parser, ec);
+		if (ec == http::error::body_limit) {
+			respond(413);
+			return;
+		}
+		if (ec) throw beast::system_error(ec);
+		full_request = parser.release();
+		state->request_body_stream = std::stringstream(std::move(full_request.body()));
+	}
+	
+	// 3. Call the middlewares and the handler
+	admission.started();
+	call_handler(*m, state, *handler);
+	admission.done();
+	
+	// 3.1. A WebSocket endpoint takes over the connection, unless a middleware responded instead
+	if (state->websocket && state->status_code == 200) {
+		if (!upgrade) {
+			http::response<http::empty_body> beast_response;
+			beast_response.version(11);
+			beast_response.result(426);
+			set_date_server(*m, beast_response);
+			beast_response.set(http::field::upgrade, "websocket");
+			beast_response.set(http::field::connection, "Upgrade");
+			beast_response.prepare_payload();
+			http::write(stream, beast_response);
+			close_stream(stream);
+			return;
+		}
+		state->path_params = &handler->path_params;
+		start_websocket(m, state, state->websocket, stream, std::move(slot), std::move(full_request));
+		return;
+	}
+	
+	// 3.2. So does an event stream endpoint. The response has no length, the events go on until
+	// the connection closes.
+	if (state->event_channel && state->status_code == 200) {
+		auto beast_response = make_response(*m, *state);
+		beast_response.erase(http::field::content_length);
+		beast_response.set(http::field::content_type, "text/event-stream");
+		beast_response.set(http::field::cache_control, "no-cache");
+		std::optional<uint64_t> last_id;
+		std::string_view last_event_id = full_request["Last-Event-ID"];
+		uint64_t id;
+		if (std::from_chars(last_event_id.data(), last_event_id.data() + last_event_id.size(), id).ec == std::errc()) {
+			last_id = id;
+		}
+		auto head = std::make_shared<const std::string>(serialize(beast_response));
+		start_event_stream(state->event_channel, stream, std::move(slot), std::move(head), last_id);
+		return;
+	}
+	
+	// 4. Write the response
+	auto beast_response = make_response(*m, *state);
+	if (m->socket_options.cork) set_cork(stream, true);
+	
+	// 4.1. Store in the response cache and hand to the coalesced requests, serialized once for all
+	std::chrono::seconds ttl {0};
+	if (cache) {
+		ttl = cache->ttl(
+			beast_response.result_int(),
+			beast_response[http::field::cache_control],
+			beast_response.find(http::field::set_cookie) != beast_response.end(),
+			beast_response[http::field::vary],
+			authorization
+		);
+	}
+	if (ttl.count() > 0 || flight) {
+		// Like a fixed response, without the Date and Server fields, which are added as it's written
+		beast_response.erase(http::field::date);
+		if (!m->server_field.empty()) beast_response.erase(http::field::server);
+		auto prepared = split_response(serialize(beast_response));
+		if (ttl.count() > 0) cache->store(std::move(cache_key), prepared, ttl);
+		bool head_request = state->method == Method::HEAD;
+		if (flight) flight->complete(prepared_bytes(*m, *prepared, head_request));
+		write_prepared(*m, stream, *prepared, head_request);
+	} else {
+		http::write(stream, beast_response);
+	}
+	if (m->socket_options.cork) set_cork(stream, false);
+	close_stream(stream);
+}
+
+}
+
+// HTTP/2, WebSockets and event streams are built on the steps above
+#include "event_stream.hpp"
+#include "http2.hpp"
+#include "websocket.hpp"
+
+#endif
@@ -0,0 +1,81 @@
+#include "internal.hpp"
+#include <sys/socket.h>
+
+namespace woof {
+
+bool
+ConnectionRegistry::make_room()
+{
+	std::lock_guard lock(mutex);
+	while (max > 0 && open >= max && !idle.empty()) {
+		ConnectionSlot *slot = idle.front();
+		idle.pop_front();
+		slot->evicted = true;
+		::shutdown(slot->fd, SHUT_RDWR);
+		--open;
+		++evicted;
+	}
+	paused = max > 0 && open >= max;
+	if (!paused) ++open;
+	return !paused;
+}
+
+ConnectionSlot::ConnectionSlot(ConnectionRegistry &r_, int fd_)
+:
+	r(r_),
+	fd(fd_)
+{
+	std::lock_guard lock(r.mutex);
+	++r.accepted;
+	idle_it = r.idle.insert(r.idle.end(), this);
+}
+
+void
+ConnectionSlot::release()
+{
+	std::lock_guard lock(r.mutex);
+	if (released) return;
+	released = true;
+	if (evicted) return;
+	if (idle_it != r.idle.end()) r.idle.erase(idle_it);
+	--r.open;
+	if (r.paused && r.resume) {
+		r.paused = false;
+		r.resume();
+	}
+}
+
+void
+ConnectionSlot::idle()
+{
+	std::lock_guard lock(r.mutex);
+	if (evicted || released || idle_it != r.idle.end()) return;
+	idle_it = r.idle.insert(r.idle.end(), this);
+}
+
+void
+ConnectionSlot::active()
+{
+	std::lock_guard lock(r.mutex);
+	if (evicted || released || idle_it == r.idle.end()) return;
+	r.idle.erase(idle_it);
+	idle_it = r.idle.end();
+}
+
+Server &
+Server::max_connections(size_t max)
+{
+	std::lock_guard lock(m->connections.mutex);
+	m->connections.max = max;
+	return *this;
+}
+
+ConnectionStats
+Server::connection_stats() const
+{
+	auto &r = m->connections;
+	std::lock_guard lock(r.mutex);
+	return {r.open, r.idle.size(), r.accepted, r.evicted};
+}
+
+}
@@ -5,10 +5,16 @@ namespace woof {
 
 static const char *level_str[] { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "CRITICAL" };
 
+const char *
+log_level_str(LogLevel level)
+{
+	return level_str[int(level)];
+}
+
 void
 default_log(LogLevel level, const char *str, size_t len)
 {
-	printf("[%s] %*s\n", level_str[int(level)], int(len), str);
+	printf("[%s] %.*s\n", level_str[int(level)], int(len), str);
 }
 
 }
@@ -0,0 +1,90 @@
+#include "internal.hpp"
+
+namespace woof {
+
+void
+Server::add_event_stream(const PathPattern &path, const EventChannel &channel)
+{
+	auto state = channel.m;
+	auto &handler = add_handler(m, Method::GET, path);
+	handler.handler = [state](Request &req, Response &) {
+		req.m->event_channel = state;
+	};
+	handler.takes_over = true;
+}
+
+EventChannel::EventChannel(size_t history, std::chrono::seconds heartbeat, size_t max_queued_bytes)
+:
+	m(std::make_shared<EventChannelState>(history, heartbeat, max_queued_bytes))
+{}
+
+uint64_t
+EventChannel::publish(std::string_view data, std::string_view event) const
+{
+	return m->publish(data, event);
+}
+
+size_t
+EventChannel::size() const
+{
+	std::lock_guard lock(m->mutex);
+	std::erase_if(m->subscribers, [](auto &p) {
+		auto subscriber = p.second.lock();
+		return !subscriber || subscriber->closed();
+	});
+	return m->subscribers.size();
+}
+
+void
+EventChannelState::subscribe(std::shared_ptr<EventSubscriber> subscriber, std::optional<uint64_t> last_id)
+{
+	std::lock_guard lock(mutex);
+	if (last_id) {
+		for (auto &[id, event] : recent) {
+			if (id > *last_id && !subscriber->send(event)) {
+				subscriber->abort();
+				return;
+			}
+		}
+	}
+	subscribers.emplace(subscriber.get(), subscriber);
+}
+
+uint64_t
+EventChannelState::publish(std::string_view data, std::string_view event)
+{
+	// Encoded without the lock. A data line per line of the data, which may end with CRLF, LF or
+	// CR, https://html.spec.whatwg.org/multipage/server-sent-events.html. A trailing line ending
+	// gets an empty last line, as the client drops the final LF.
+	std::string body;
+	if (!event.empty()) body.append("event: ").append(event).push_back('\n');
+	for (size_t i = 0;;) {
+		size_t j = data.find_first_of("\r\n", i);
+		body.append("data: ").append(data.substr(i, j - i)).push_back('\n');
+		if (j == std::string_view::npos) break;
+		i = j + 1 + (data[j] == '\r' && j + 1 < data.size() && data[j+1] == '\n');
+	}
+	
+	std::lock_guard lock(mutex);
+	uint64_t id = next_id++;
+	auto bytes = std::make_shared<const std::string>("id: " + std::to_string(id) + '\n' + body + '\n');
+	if (history > 0) {
+		if (recent.size() == history) recent.pop_front();
+		recent.emplace_back(id, bytes);
+	}
+	for (auto it = subscribers.begin(); it != subscribers.end();) {
+		auto subscriber = it->second.lock();
+		if (!subscriber || subscriber->closed()) {
+			it = subscribers.erase(it);
+		} else if (!subscriber->send(bytes)) {
+			// A slow consumer
+			subscriber->abort();
+			it = subscribers.erase(it);
+		} else {
+			++it;
+		}
+	}
+	return id;
+}
+
+}
@@ -0,0 +1,189 @@
+#ifndef _WOOF_event_stream_hpp
+#define _WOOF_event_stream_hpp
+
+#include "connection.hpp"
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <deque>
+
+namespace woof {
+
+// Like WebSocketSession, everything touching the stream runs on the strand. Queued events are
+// written with one gathered write. Whatever the client sends is read and ignored, only to notice
+// when it goes away.
+template<class Stream>
+class EventStreamSession : public EventSubscriber, public std::enable_shared_from_this<EventStreamSession<Stream>> {
+	using Timer = boost::asio::basic_waitable_timer<
+		std::chrono::steady_clock, boost::asio::wait_traits<std::chrono::steady_clock>, typename Stream::executor_type
+	>;
+	
+	std::shared_ptr<EventChannelState> channel;
+	Stream stream;
+	boost::asio::strand<typename Stream::executor_type> strand;
+	Timer timer;
+	std::shared_ptr<ConnectionSlot> slot; // Counts the connection while the session lasts
+	std::deque<std::shared_ptr<const std::string>> queue;
+	std::vector<boost::asio::const_buffer> buffers;
+	size_t writing = 0; // Queued events being written
+	std::chrono::steady_clock::time_point last_write;
+	std::atomic<size_t> queued_bytes = 0;
+	std::atomic<bool> finished = false;
+	char discard[512];
+	
+	template<class F>
+	void
+	on_strand(F &&f)
+	{ boost::asio::dispatch(strand, std::forward<F>(f)); }
+	
+	template<class F>
+	auto
+	strand_handler(F f)
+	{
+		return [s = this->shared_from_this(), f = std::move(f)](auto ...args) mutable {
+			s->on_strand([f = std::move(f), args...]() mutable { f(args...); });
+		};
+	}
+	
+	void
+	finish()
+	{
+		if (finished.exchange(true)) return;
+		queue.clear();
+		timer.cancel();
+		beast::get_lowest_layer(stream).close();
+	}
+	
+	void
+	read()
+	{
+		stream.async_read_some(boost::asio::buffer(discard), strand_handler(
+			[s = this->shared_from_this()](beast::error_code ec, size_t) {
+				if (ec) {
+					s->finish();
+					return;
+				}
+				s->read();
+			}
+		));
+	}
+	
+	void
+	write()
+	{
+		if (writing || queue.empty() || finished) return;
+		buffers.clear();
+		for (auto &bytes : queue) buffers.push_back(boost::asio::buffer(*bytes));
+		writing = queue.size();
+		beast::net::async_write(stream, buffers, strand_handler(
+			[s = this->shared_from_this()](beast::error_code ec, size_t n) {
+				if (ec) {
+					s->finish();
+					return;
+				}
+				s->queued_bytes -= n;
+				s->queue.erase(s->queue.begin(), s->queue.begin() + s->writing);
+				s->writing = 0;
+				s->last_write = std::chrono::steady_clock::now();
+				s->write();
+			}
+		));
+	}
+	
+	// A comment line is sent when nothing else has been for a heartbeat, so that proxies don't time
+	// out the connection
+	void
+	heartbeat()
+	{
+		// A write that's still going doesn't move last_write, so a skipped heartbeat waits a whole one
+		auto now = std::chrono::steady_clock::now();
+		auto at = last_write + channel->heartbeat;
+		timer.expires_at(at > now ? at : now + channel->heartbeat);
+		timer.async_wait(strand_handler([s = this->shared_from_this()](beast::error_code ec) {
+			if (ec || s->finished) return;
+			if (std::chrono::steady_clock::now() - s->last_write >= s->channel->heartbeat && !s->writing) {
+				static const auto comment = std::make_shared<const std::string>(":\n\n");
+				s->queued_bytes += comment->size();
+				s->queue.push_back(comment);
+				s->write();
+				s->last_write = std::chrono::steady_clock::now();
+			}
+			s->heartbeat();
+		}));
+	}
+	
+public:
+	
+	EventStreamSession(std::shared_ptr<EventChannelState> channel_, Stream &&stream_, std::shared_ptr<ConnectionSlot> slot_)
+	:
+		channel(std::move(channel_)),
+		stream(std::move(stream_)),
+		strand(stream.get_executor()),
+		timer(stream.get_executor()),
+		slot(std::move(slot_))
+	{}
+	
+	// `head` is the serialized response head, written before any event
+	void
+	run(std::shared_ptr<const std::string> head, std::optional<uint64_t> last_id)
+	{
+		if constexpr (requires { beast::get_lowest_layer(stream).expires_never(); }) {
+			beast::get_lowest_layer(stream).expires_never();
+		}
+		on_strand([s = this->shared_from_this(), head = std::move(head), last_id] {
+			s->queued_bytes += head->size();
+			s->queue.push_back(head);
+			s->last_write = std::chrono::steady_clock::now();
+			s->write();
+			s->channel->subscribe(s, last_id);
+			s->read();
+			if (s->channel->heartbeat.count() > 0) s->heartbeat();
+		});
+	}
+	
+	virtual bool
+	send(std::shared_ptr<const std::string> event) override
+	{
+		if (finished) return false;
+		if (queued_bytes.fetch_add(event->size()) + event->size() > channel->max_queued_bytes) {
+			queued_bytes -= event->size();
+			return false;
+		}
+		on_strand([s = this->shared_from_this(), event = std::move(event)]() mutable {
+			if (s->finished) return;
+			s->queue.push_back(std::move(event));
+			s->write();
+		});
+		return true;
+	}
+	
+	virtual void
+	abort() override
+	{
+		on_strand([s = this->shared_from_this()] {
+			s->finish();
+		});
+	}
+	
+	virtual bool
+	closed() const override
+	{ return finished; }
+};
+
+template<class Stream>
+void
+start_event_stream(
+	std::shared_ptr<EventChannelState> channel,
+	Stream &stream,
+	std::shared_ptr<ConnectionSlot> slot,
+	std::shared_ptr<const std::string> head,
+	std::optional<uint64_t> last_id
+)
+{
+	auto session = std::make_shared<EventStreamSession<Stream>>(std::move(channel), std::move(stream), std::move(slot));
+	session->run(std::move(head), last_id);
+}
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include "internal.hpp"
+#include <boost/beast/http/field.hpp>
+#include <array>
+
+namespace http = boost::beast::http;
+
+namespace woof {
+
+static constexpr http::field beast_fields[] {
+	http::field::unknown,
+	http::field::accept,
+	http::field::accept_charset,
+	http::field::accept_encoding,
+	http::field::accept_language,
+	http::field::accept_ranges,
+	http::field::access_control_allow_credentials,
+	http::field::access_control_allow_headers,
+	http::field::access_control_allow_methods,
+	http::field::access_control_allow_origin,
+	http::field::access_control_expose_headers,
+	http::field::access_control_max_age,
+	http::field::access_control_request_headers,
+	http::field::access_control_request_method,
+	http::field::age,
+	http::field::allow,
+	http::field::authorization,
+	http::field::cache_control,
+	http::field::connection,
+	http::field::content_disposition,
+	http::field::content_encoding,
+	http::field::content_language,
+	http::field::content_length,
+	http::field::content_location,
+	http::field::content_range,
+	http::field::content_type,
+	http::field::cookie,
+	http::field::date,
+	http::field::etag,
+	http::field::expect,
+	http::field::expires,
+	http::field::forwarded,
+	http::field::from,
+	http::field::host,
+	http::field::if_match,
+	http::field::if_modified_since,
+	http::field::if_none_match,
+	http::field::if_range,
+	http::field::if_unmodified_since,
+	http::field::keep_alive,
+	http::field::last_modified,
+	http::field::link,
+	http::field::location,
+	http::field::origin,
+	http::field::pragma,
+	http::field::proxy_authorization,
+	http::field::range,
+	http::field::referer,
+	http::field::retry_after,
+	http::field::server,
+	http::field::set_cookie,
+	http::field::te,
+	http::field::trailer,
+	http::field::transfer_encoding,
+	http::field::upgrade,
+	http::field::user_agent,
+	http::field::vary,
+	http::field::via,
+	http::field::www_authenticate,
+};
+
+static_assert(std::size(beast_fields) == size_t(Field::COUNT));
+
+static const auto from_beast = [] {
+	std::array<Field, size_t(http::field::xref) + 1> table;
+	table.fill(Field::UNKNOWN);
+	for (size_t i = 1; i < std::size(beast_fields); ++i) {
+		table[size_t(beast_fields[i])] = Field(i);
+	}
+	return table;
+}();
+
+Field
+field_from_beast(unsigned field)
+{
+	return field < from_beast.size() ? from_beast[field] : Field::UNKNOWN;
+}
+
+unsigned
+beast_field(Field field)
+{
+	return unsigned(beast_fields[size_t(field)]);
+}
+
+std::string_view
+field_name(Field field)
+{
+	return http::to_string(beast_fields[size_t(field)]);
+}
+
+Field
+field_from_name(std::string_view name)
+{
+	return field_from_beast(unsigned(http::string_to_field(name)));
+}
+
+}
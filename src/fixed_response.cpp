@@ -0,0 +1,96 @@
+#include "internal.hpp"
+#include <boost/beast/http/status.hpp>
+#include <ctime>
+
+namespace woof {
+
+namespace http = boost::beast::http;
+
+std::shared_ptr<const PreparedResponse>
+prepare_response(const FixedResponse &response)
+{
+	auto prepared = std::make_shared<PreparedResponse>();
+	prepared->response = response;
+	int status = response.status.code;
+	std::string &head = prepared->head;
+	head.append("HTTP/1.1 ").append(std::to_string(status)).append(" ");
+	head.append(http::obsolete_reason(http::status(status))).append("\r\n");
+	if (!response.content_type.empty()) head.append("Content-Type: ").append(response.content_type).append("\r\n");
+	for (auto &[name, value] : response.headers) head.append(name).append(": ").append(value).append("\r\n");
+	bool has_body = status >= 200 && status != 204 && status != 304;
+	if (has_body) head.append("Content-Length: ").append(std::to_string(response.body.size())).append("\r\n");
+	prepared->tail.append("\r\n");
+	if (has_body) prepared->tail.append(response.body);
+	return prepared;
+}
+
+std::shared_ptr<const std::string>
+prepared_bytes(const ServerState &m, const PreparedResponse &response, bool head_request, std::string_view extra)
+{
+	std::string_view tail = response.tail;
+	return std::make_shared<const std::string>(
+		response.head + std::string(extra) + std::string(date_field()) + m.server_field
+			+ std::string(head_request ? tail.substr(0, 2) : tail)
+	);
+}
+
+const PreparedResponse &
+find_error_response(const ServerState &m, int status)
+{
+	auto it = m.error_responses.find(status);
+	if (it != m.error_responses.end()) return *it->second;
+	// Empty ones for every status Beast knows
+	static const auto defaults = [] {
+		std::unordered_map<int, std::shared_ptr<const PreparedResponse>> defaults;
+		for (int status = 100; status < 600; ++status) {
+			if (http::int_to_status(status) == http::status::unknown) continue;
+			defaults.emplace(status, prepare_response({.status = status, .content_type = {}}));
+		}
+		return defaults;
+	}();
+	auto d = defaults.find(status);
+	return *(d != defaults.end() ? d : defaults.find(500))->second;
+}
+
+std::string_view
+date_field()
+{
+	static constexpr const char *days[] { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static constexpr const char *months[] {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	thread_local time_t cached = -1;
+	thread_local char field[48];
+	thread_local int length = 0;
+	time_t now = ::time(nullptr);
+	if (now != cached) {
+		struct tm tm;
+		::gmtime_r(&now, &tm);
+		length = snprintf(field, sizeof(field), "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n",
+			days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+		cached = now;
+	}
+	return {field, size_t(length)};
+}
+
+Server &
+Server::server_header(const std::string &value)
+{
+	m->server_field = value.empty() ? std::string() : "Server: " + value + "\r\n";
+	return *this;
+}
+
+Server &
+Server::error_response(const FixedResponse &response)
+{
+	m->error_responses[response.status.code] = prepare_response(response);
+	return *this;
+}
+
+void
+Server::add_fixed_response(Method method, const PathPattern &path, const FixedResponse &response)
+{
+	add_handler(m, method, path).fixed = prepare_response(response);
+}
+
+}
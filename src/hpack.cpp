@@ -0,0 +1,362 @@
+#include "internal.hpp"
+
+namespace woof {
+
+// RFC 7541, Appendix B. The EOS symbol, 256, is 30 ones.
+static constexpr uint32_t HUFFMAN_CODES[257] = {
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff,
+};
+
+static constexpr uint8_t HUFFMAN_LENGTHS[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+static constexpr std::pair<std::string_view, std::string_view> STATIC_TABLE[] = {
+	{":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+	{":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+	{":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+	{"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""},
+	{"cache-control", ""}, {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""},
+	{"content-length", ""}, {"content-location", ""}, {"content-range", ""}, {"content-type", ""},
+	{"cookie", ""}, {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+	{"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""},
+	{"if-unmodified-since", ""}, {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""},
+	{"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+	{"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+	{"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""},
+};
+static constexpr size_t STATIC_TABLE_SIZE = std::size(STATIC_TABLE);
+
+// An entry's size counts 32 bytes of overhead besides the name and value
+static constexpr size_t ENTRY_OVERHEAD = 32;
+
+// Decoding walks a binary tree of the codes bit by bit. Node 0 is the root, leaves have no children.
+struct HuffmanNode {
+	int16_t child[2] = {-1, -1};
+	int16_t symbol = -1;
+};
+
+static const std::vector<HuffmanNode> &
+huffman_tree()
+{
+	static const std::vector<HuffmanNode> tree = [] {
+		std::vector<HuffmanNode> tree(1);
+		for (int symbol = 0; symbol < 257; ++symbol) {
+			int node = 0;
+			for (int bit = HUFFMAN_LENGTHS[symbol] - 1; bit >= 0; --bit) {
+				int b = (HUFFMAN_CODES[symbol] >> bit) & 1;
+				if (tree[node].child[b] < 0) {
+					tree[node].child[b] = tree.size();
+					tree.emplace_back();
+				}
+				node = tree[node].child[b];
+			}
+			tree[node].symbol = symbol;
+		}
+		return tree;
+	}();
+	return tree;
+}
+
+static bool
+huffman_decode(std::string_view s, std::string &out)
+{
+	const std::vector<HuffmanNode> &tree = huffman_tree();
+	int node = 0, depth = 0;
+	bool ones = true;
+	for (unsigned char c : s) {
+		for (int bit = 7; bit >= 0; --bit) {
+			int b = (c >> bit) & 1;
+			node = tree[node].child[b];
+			if (node < 0) return false;
+			++depth;
+			ones = ones && b;
+			if (tree[node].symbol >= 0) {
+				if (tree[node].symbol == 256) return false;
+				out.push_back(char(tree[node].symbol));
+				node = depth = 0;
+				ones = true;
+			}
+		}
+	}
+	// Padding is a prefix of EOS, shorter than a byte
+	return depth < 8 && ones;
+}
+
+static size_t
+huffman_length(std::string_view s)
+{
+	size_t bits = 0;
+	for (unsigned char c : s) bits += HUFFMAN_LENGTHS[c];
+	return (bits + 7) / 8;
+}
+
+static void
+huffman_encode(std::string_view s, std::string &out)
+{
+	uint64_t acc = 0;
+	int nbits = 0;
+	for (unsigned char c : s) {
+		acc = acc << HUFFMAN_LENGTHS[c] | HUFFMAN_CODES[c];
+		nbits += HUFFMAN_LENGTHS[c];
+		while (nbits >= 8) {
+			nbits -= 8;
+			out.push_back(char(acc >> nbits));
+		}
+	}
+	if (nbits > 0) out.push_back(char(acc << (8 - nbits) | (0xff >> nbits)));
+}
+
+// Integers have an N-bit prefix in the first byte, the bits above it are set by the caller
+static bool
+decode_integer(std::string_view &s, int prefix_bits, uint64_t &value)
+{
+	if (s.empty()) return false;
+	uint64_t max_prefix = (1 << prefix_bits) - 1;
+	value = uint8_t(s[0]) & max_prefix;
+	s.remove_prefix(1);
+	if (value < max_prefix) return true;
+	for (int shift = 0; ; shift += 7) {
+		if (s.empty() || shift > 28) return false;
+		uint8_t b = s[0];
+		s.remove_prefix(1);
+		value += uint64_t(b & 0x7f) << shift;
+		if (!(b & 0x80)) return true;
+	}
+}
+
+static void
+encode_integer(std::string &out, uint8_t first, int prefix_bits, uint64_t value)
+{
+	uint64_t max_prefix = (1 << prefix_bits) - 1;
+	if (value < max_prefix) {
+		out.push_back(char(first | value));
+		return;
+	}
+	out.push_back(char(first | max_prefix));
+	value -= max_prefix;
+	while (value >= 0x80) {
+		out.push_back(char(0x80 | (value & 0x7f)));
+		value >>= 7;
+	}
+	out.push_back(char(value));
+}
+
+static bool
+decode_string(std::string_view &s, std::string &out)
+{
+	if (s.empty()) return false;
+	bool huffman = s[0] & 0x80;
+	uint64_t length;
+	if (!decode_integer(s, 7, length) || length > s.size()) return false;
+	std::string_view raw = s.substr(0, length);
+	s.remove_prefix(length);
+	out.clear();
+	if (!huffman) {
+		out.assign(raw);
+		return true;
+	}
+	return huffman_decode(raw, out);
+}
+
+static void
+encode_string(std::string &out, std::string_view s)
+{
+	size_t huffman = huffman_length(s);
+	if (huffman < s.size()) {
+		encode_integer(out, 0x80, 7, huffman);
+		huffman_encode(s, out);
+	} else {
+		encode_integer(out, 0, 7, s.size());
+		out.append(s);
+	}
+}
+
+bool
+HpackDecoder::lookup(uint64_t index, std::string &name, std::string *value) const
+{
+	if (index == 0) return false;
+	if (index <= STATIC_TABLE_SIZE) {
+		name = STATIC_TABLE[index - 1].first;
+		if (value) *value = STATIC_TABLE[index - 1].second;
+		return true;
+	}
+	index -= STATIC_TABLE_SIZE + 1;
+	if (index >= table.size()) return false;
+	name = table[index].first;
+	if (value) *value = table[index].second;
+	return true;
+}
+
+void
+HpackDecoder::evict(size_t room)
+{
+	while (!table.empty() && table_size + room > max_table_size) {
+		table_size -= table.back().first.size() + table.back().second.size() + ENTRY_OVERHEAD;
+		table.pop_back();
+	}
+}
+
+void
+HpackDecoder::insert(const std::string &name, const std::string &value)
+{
+	size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+	evict(size);
+	// An entry larger than the whole table just empties it
+	if (size > max_table_size) return;
+	table.emplace_front(name, value);
+	table_size += size;
+}
+
+bool
+HpackDecoder::decode(std::string_view s, std::vector<std::pair<std::string, std::string>> &headers)
+{
+	size_t list_size = 0;
+	while (!s.empty()) {
+		uint8_t b = s[0];
+		std::string name, value;
+		uint64_t index;
+		if (b & 0x80) {
+			// Indexed field
+			if (!decode_integer(s, 7, index) || !lookup(index, name, &value)) return false;
+		} else if ((b & 0xe0) == 0x20) {
+			// Dynamic table size update
+			if (!decode_integer(s, 5, index) || index > settings_max_table_size) return false;
+			max_table_size = index;
+			evict(0);
+			continue;
+		} else {
+			// Literal with incremental indexing (01), without indexing (0000) or never indexed (0001)
+			bool indexing = b & 0x40;
+			if (!decode_integer(s, indexing ? 6 : 4, index)) return false;
+			if (index ? !lookup(index, name, nullptr) : !decode_string(s, name)) return false;
+			if (!decode_string(s, value)) return false;
+			if (indexing) insert(name, value);
+		}
+		list_size += name.size() + value.size() + ENTRY_OVERHEAD;
+		if (list_size > MAX_HEADER_LIST_SIZE) return false;
+		headers.emplace_back(std::move(name), std::move(value));
+	}
+	return true;
+}
+
+void
+HpackEncoder::max_table_size(size_t size)
+{
+	size = std::min<size_t>(size, 4096);
+	if (size == max_size) return;
+	max_size = size;
+	size_update = true;
+	evict(0);
+}
+
+void
+HpackEncoder::evict(size_t room)
+{
+	while (!table.empty() && table_size + room > max_size) {
+		table_size -= table.back().first.size() + table.back().second.size() + ENTRY_OVERHEAD;
+		table.pop_back();
+	}
+}
+
+void
+HpackEncoder::begin(std::string &out)
+{
+	if (!size_update) return;
+	encode_integer(out, 0x20, 5, max_size);
+	size_update = false;
+}
+
+void
+HpackEncoder::encode(std::string &out, std::string_view name, std::string_view value)
+{
+	// 1. Look for the whole field, or else its name, in the static and dynamic tables
+	uint64_t name_index = 0;
+	for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i) {
+		if (STATIC_TABLE[i].first != name) continue;
+		if (STATIC_TABLE[i].second == value) {
+			encode_integer(out, 0x80, 7, i + 1);
+			return;
+		}
+		if (!name_index) name_index = i + 1;
+	}
+	for (size_t i = 0; i < table.size(); ++i) {
+		if (table[i].first != name) continue;
+		if (table[i].second == value) {
+			encode_integer(out, 0x80, 7, STATIC_TABLE_SIZE + 1 + i);
+			return;
+		}
+		if (!name_index) name_index = STATIC_TABLE_SIZE + 1 + i;
+	}
+	
+	// 2. Values that change with every response aren't worth a table entry, and secrets are never
+	// indexed, so that intermediaries don't either
+	bool sensitive = name == "set-cookie" || name == "authorization";
+	bool indexing = !sensitive && name != "content-length" && name != "date" && name != "etag"
+		&& name != "last-modified" && name != "location" && name.size() + value.size() + ENTRY_OVERHEAD <= max_size / 2;
+	if (indexing) {
+		encode_integer(out, 0x40, 6, name_index);
+	} else {
+		encode_integer(out, sensitive ? 0x10 : 0, 4, name_index);
+	}
+	if (!name_index) encode_string(out, name);
+	encode_string(out, value);
+	
+	if (indexing) {
+		size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+		evict(size);
+		table.emplace_front(name, value);
+		table_size += size;
+	}
+}
+
+}
@@ -0,0 +1,823 @@
+#ifndef _WOOF_http2_hpp
+#define _WOOF_http2_hpp
+
+#include "connection.hpp"
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+#include <deque>
+#include <map>
+
+namespace woof {
+
+// RFC 7540 6 and 7
+enum class H2Frame : uint8_t {
+	DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE, CONTINUATION
+};
+
+enum class H2Error : uint32_t {
+	NO_ERROR, PROTOCOL_ERROR, INTERNAL_ERROR, FLOW_CONTROL_ERROR, SETTINGS_TIMEOUT, STREAM_CLOSED,
+	FRAME_SIZE_ERROR, REFUSED_STREAM, CANCEL, COMPRESSION_ERROR, CONNECT_ERROR, ENHANCE_YOUR_CALM,
+	INADEQUATE_SECURITY, HTTP_1_1_REQUIRED
+};
+
+inline constexpr uint8_t H2_END_STREAM  = 0x1;
+inline constexpr uint8_t H2_ACK         = 0x1;
+inline constexpr uint8_t H2_END_HEADERS = 0x4;
+inline constexpr uint8_t H2_PADDED      = 0x8;
+inline constexpr uint8_t H2_PRIORITY    = 0x20;
+
+inline uint32_t
+h2_u32(const char *p)
+{
+	auto b = reinterpret_cast<const uint8_t *>(p);
+	return uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+}
+
+inline void
+h2_append_u32(std::string &out, uint32_t n)
+{
+	const char b[4] = {char(n >> 24), char(n >> 16), char(n >> 8), char(n)};
+	out.append(b, 4);
+}
+
+inline void
+h2_frame(std::string &out, H2Frame type, uint8_t flags, uint32_t stream_id, std::string_view payload = {})
+{
+	size_t n = payload.size();
+	const char header[5] = {char(n >> 16), char(n >> 8), char(n), char(type), char(flags)};
+	out.append(header, 5);
+	h2_append_u32(out, stream_id);
+	out.append(payload);
+}
+
+// For the HTTP2-Settings header of an h2c upgrade. Returns false if it isn't valid base64url.
+inline bool
+base64url_decode(std::string_view s, std::string &out)
+{
+	uint32_t acc = 0;
+	int nbits = 0;
+	for (char c : s) {
+		int v;
+		if      (c >= 'A' && c <= 'Z') v = c - 'A';
+		else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') v = c - '0' + 52;
+		else if (c == '-') v = 62;
+		else if (c == '_') v = 63;
+		else if (c == '=') break;
+		else return false;
+		acc = acc << 6 | v;
+		nbits += 6;
+		if (nbits >= 8) {
+			nbits -= 8;
+			out.push_back(char(acc >> nbits));
+		}
+	}
+	return true;
+}
+
+// An HTTP/2 connection, RFC 7540. Like a WebSocket session, it takes over the stream and runs
+// asynchronously: frames are read and written on a strand, and each stream whose request is
+// complete is handled on the workers with the same steps as an HTTP/1 request. A slow handler holds
+// up neither the other streams nor the frames that keep the connection going, e.g. PING and
+// WINDOW_UPDATE. Responses of different streams are interleaved on the wire as flow control allows.
+template<class Stream>
+class Http2Connection : public std::enable_shared_from_this<Http2Connection<Stream>> {
+	static constexpr uint32_t MAX_CONCURRENT_STREAMS = 100;
+	static constexpr uint32_t MAX_FRAME_SIZE = 16384; // Ours, the smallest allowed
+	static constexpr int64_t DEFAULT_WINDOW = 65535;
+	static constexpr int64_t MAX_WINDOW = 0x7fffffff;
+	
+	struct H2Stream {
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::string body;
+		bool ended = false; // The request is complete
+		uint64_t body_limit = BODY_LIMIT;
+		bool too_large = false; // Answered with 413, the rest of the body is dropped
+		int64_t window = DEFAULT_WINDOW; // Send window
+		std::string data; // Response body left to send, from `sent` on
+		size_t sent = 0;
+	};
+	
+	// A stream's request, moved out of it while a worker handles it, so that frames are handled
+	// meanwhile
+	struct H2Request {
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::string body;
+		bool too_large = false;
+		bool head_request = false;
+	};
+	
+	std::shared_ptr<ServerState> m;
+	Stream stream;
+	boost::asio::strand<typename Stream::executor_type> strand;
+	beast::flat_buffer buffer;
+	std::shared_ptr<const ConnectionState> connection;
+	std::shared_ptr<ConnectionSlot> slot; // Counts the connection while it lasts
+	bool expired;
+	std::string_view preface; // What's left to read of the client connection preface
+	
+	HpackDecoder decoder;
+	HpackEncoder encoder;
+	std::map<uint32_t, H2Stream> streams;
+	std::deque<uint32_t> ready;   // Streams with a complete request, in order
+	std::deque<uint32_t> sending; // Streams with response data left
+	uint32_t last_stream_id = 0;
+	// A header block split into CONTINUATION frames
+	uint32_t continuation = 0;
+	std::string header_block;
+	bool header_block_ends_stream = false;
+	
+	int64_t window = DEFAULT_WINDOW; // Connection send window
+	int64_t initial_window = DEFAULT_WINDOW; // The peer's settings
+	uint32_t max_frame_size = 16384;
+	bool goaway = false;
+	int handling = 0; // Streams being handled by workers
+	std::string out; // Frames to write
+	std::string writing; // Frames being written
+	bool finished = false; // No more frames are read, the connection closes once `out` is written
+	bool closed = false;
+	
+	template<class F>
+	void
+	on_strand(F &&f)
+	{ boost::asio::dispatch(strand, std::forward<F>(f)); }
+	
+	template<class F>
+	auto
+	strand_handler(F f)
+	{
+		return [s = this->shared_from_this(), f = std::move(f)](auto ...args) mutable {
+			s->on_strand([f = std::move(f), args...]() mutable { f(args...); });
+		};
+	}
+	
+	// Frames queued while a write is going go out with the next one
+	void
+	write_out()
+	{
+		if (!writing.empty() || out.empty() || closed) return;
+		std::swap(writing, out);
+		beast::net::async_write(stream, beast::net::buffer(writing), strand_handler(
+			[s = this->shared_from_this()](beast::error_code ec, size_t) {
+				s->writing.clear();
+				if (ec) {
+					s->out.clear();
+					s->finished = true;
+				}
+				s->write_out();
+				if (s->finished && s->writing.empty()) s->close();
+			}
+		));
+	}
+	
+	void
+	finish()
+	{
+		if (finished) return;
+		finished = true;
+		write_out();
+		if (writing.empty()) close();
+	}
+	
+	// The slot is released before the socket's closed, see ConnectionSlot
+	void
+	close()
+	{
+		if (closed) return;
+		closed = true;
+		if (slot) slot->release();
+		beast::get_lowest_layer(stream).close();
+	}
+	
+	// Returns false, so that it can be returned from read_frame. The connection is finished by the
+	// caller.
+	bool
+	connection_error(H2Error error)
+	{
+		std::string payload;
+		h2_append_u32(payload, last_stream_id);
+		h2_append_u32(payload, uint32_t(error));
+		h2_frame(out, H2Frame::GOAWAY, 0, 0, payload);
+		return false;
+	}
+	
+	void
+	stream_error(uint32_t id, H2Error error)
+	{
+		std::string payload;
+		h2_append_u32(payload, uint32_t(error));
+		h2_frame(out, H2Frame::RST_STREAM, 0, id, payload);
+		streams.erase(id);
+		std::erase(ready, id);
+		std::erase(sending, id);
+	}
+	
+	void
+	window_update(uint32_t id, uint32_t increment)
+	{
+		std::string payload;
+		h2_append_u32(payload, increment);
+		h2_frame(out, H2Frame::WINDOW_UPDATE, 0, id, payload);
+	}
+	
+	// Whether the buffer holds a whole frame, or the header of one that's too large, which
+	// read_frame rejects
+	bool
+	has_frame() const
+	{
+		if (buffer.size() < 9) return false;
+		auto header = static_cast<const uint8_t *>(buffer.data().data());
+		uint32_t length = uint32_t(header[0]) << 16 | uint32_t(header[1]) << 8 | header[2];
+		return length > MAX_FRAME_SIZE || buffer.size() >= 9 + length;
+	}
+	
+	bool
+	apply_settings(std::string_view payload)
+	{
+		for (; payload.size() >= 6; payload.remove_prefix(6)) {
+			uint16_t id = uint8_t(payload[0]) << 8 | uint8_t(payload[1]);
+			uint32_t value = h2_u32(payload.data() + 2);
+			switch (id) {
+			case 0x1: // SETTINGS_HEADER_TABLE_SIZE
+				encoder.max_table_size(value);
+				break;
+			case 0x4: // SETTINGS_INITIAL_WINDOW_SIZE, which applies to the open streams retroactively
+				if (value > MAX_WINDOW) return connection_error(H2Error::FLOW_CONTROL_ERROR);
+				for (auto &[id, s] : streams) {
+					s.window += int64_t(value) - initial_window;
+				}
+				initial_window = value;
+				break;
+			case 0x5: // SETTINGS_MAX_FRAME_SIZE
+				if (value < 16384 || value > 16777215) return connection_error(H2Error::PROTOCOL_ERROR);
+				max_frame_size = value;
+				break;
+			}
+		}
+		return true;
+	}
+	
+	// A complete header block opens a stream, or is the trailers of one
+	bool
+	headers_done(uint32_t id, bool end_stream)
+	{
+		std::vector<std::pair<std::string, std::string>> headers;
+		bool ok = decoder.decode(header_block, headers);
+		header_block.clear();
+		continuation = 0;
+		if (!ok) return connection_error(H2Error::COMPRESSION_ERROR);
+		
+		auto it = streams.find(id);
+		if (it != streams.end()) {
+			// Trailers, which aren't passed on
+			if (it->second.ended || !end_stream) return connection_error(H2Error::PROTOCOL_ERROR);
+			it->second.ended = true;
+			ready.push_back(id);
+			return true;
+		}
+		if (id <= last_stream_id) return connection_error(H2Error::PROTOCOL_ERROR);
+		last_stream_id = id;
+		if (goaway || streams.size() >= MAX_CONCURRENT_STREAMS) {
+			stream_error(id, H2Error::REFUSED_STREAM);
+			return true;
+		}
+		H2Stream &s = streams[id];
+		s.headers = std::move(headers);
+		s.window = initial_window;
+		if (end_stream) {
+			s.ended = true;
+			ready.push_back(id);
+		} else {
+			s.body_limit = body_limit(s);
+		}
+		return true;
+	}
+	
+	// The same limit as for an HTTP/1 body, see handle_connection
+	uint64_t
+	body_limit(const H2Stream &s)
+	{
+		if (m->multipart.empty()) return BODY_LIMIT;
+		std::string_view path, content_type;
+		for (auto &[name, value] : s.headers) {
+			if      (name == ":path")        path = value;
+			else if (name == "content-type") content_type = value;
+		}
+		ConnectionState state;
+		if (!load_target(state, path)) return BODY_LIMIT;
+		std::string boundary;
+		const MultipartConfig *config = find_multipart(*m, state.target.path_segments, content_type, boundary);
+		return config ? config->max_size : BODY_LIMIT;
+	}
+	
+	// Once the response is sent, a client that's still sending the request is told to stop,
+	// RFC 7540 8.1
+	void
+	response_done(typename std::map<uint32_t, H2Stream>::iterator it)
+	{
+		if (!it->second.ended) {
+			std::string payload;
+			h2_append_u32(payload, uint32_t(H2Error::NO_ERROR));
+			h2_frame(out, H2Frame::RST_STREAM, 0, it->first, payload);
+		}
+		streams.erase(it);
+	}
+	
+	// Handles the frame at the front of the buffer, see has_frame. Returns false if the connection is
+	// done.
+	bool
+	read_frame()
+	{
+		const char *header = static_cast<const char *>(buffer.data().data());
+		uint32_t length = uint8_t(header[0]) << 16 | uint8_t(header[1]) << 8 | uint8_t(header[2]);
+		H2Frame type = H2Frame(header[3]);
+		uint8_t flags = header[4];
+		uint32_t id = h2_u32(header + 5) & 0x7fffffff;
+		if (length > MAX_FRAME_SIZE) return connection_error(H2Error::FRAME_SIZE_ERROR);
+		std::string payload(static_cast<const char *>(buffer.data().data()) + 9, length);
+		buffer.consume(9 + length);
+		
+		if (continuation && (type != H2Frame::CONTINUATION || id != continuation)) {
+			return connection_error(H2Error::PROTOCOL_ERROR);
+		}
+		
+		// Padding is a length byte in front and that many bytes at the end
+		auto strip_padding = [&]() {
+			if (!(flags & H2_PADDED)) return true;
+			if (payload.empty() || uint8_t(payload[0]) >= payload.size()) return false;
+			payload.resize(payload.size() - uint8_t(payload[0]));
+			payload.erase(0, 1);
+			return true;
+		};
+		
+		switch (type) {
+		case H2Frame::DATA: {
+			if (id == 0) return connection_error(H2Error::PROTOCOL_ERROR);
+			// The whole frame counts towards flow control. The connection's window is opened again
+			// right away, whether the data is kept or dropped, so that other streams don't stall.
+			if (length > 0) window_update(0, length);
+			if (!strip_padding()) return connection_error(H2Error::PROTOCOL_ERROR);
+			auto it = streams.find(id);
+			if (it != streams.end() && it->second.too_large) break;
+			if (it == streams.end() || it->second.ended) {
+				if (id > last_stream_id) return connection_error(H2Error::PROTOCOL_ERROR);
+				stream_error(id, H2Error::STREAM_CLOSED);
+				break;
+			}
+			H2Stream &s = it->second;
+			if (s.body.size() + payload.size() > s.body_limit) {
+				// The stream's window stays closed, and a 413 goes out without waiting for the rest
+				s.too_large = true;
+				s.ended = flags & H2_END_STREAM;
+				std::string().swap(s.body);
+				ready.push_back(id);
+				break;
+			}
+			s.body.append(payload);
+			if (flags & H2_END_STREAM) {
+				s.ended = true;
+				ready.push_back(id);
+			} else if (length > 0) {
+				// The stream's window only for what's kept
+				window_update(id, length);
+			}
+		} break;
+		case H2Frame::HEADERS: {
+			if (id == 0 || id % 2 == 0) return connection_error(H2Error::PROTOCOL_ERROR);
+			if (!strip_padding()) return connection_error(H2Error::PROTOCOL_ERROR);
+			if (flags & H2_PRIORITY) {
+				if (payload.size() < 5) return connection_error(H2Error::FRAME_SIZE_ERROR);
+				payload.erase(0, 5);
+			}
+			header_block = std::move(payload);
+			header_block_ends_stream = flags & H2_END_STREAM;
+			if (flags & H2_END_HEADERS) return headers_done(id, header_block_ends_stream);
+			continuation = id;
+		} break;
+		case H2Frame::CONTINUATION: {
+			if (id != continuation) return connection_error(H2Error::PROTOCOL_ERROR);
+			header_block.append(payload);
+			if (header_block.size() > HpackDecoder::MAX_HEADER_LIST_SIZE) {
+				return connection_error(H2Error::PROTOCOL_ERROR);
+			}
+			if (flags & H2_END_HEADERS) return headers_done(id, header_block_ends_stream);
+		} break;
+		case H2Frame::PRIORITY:
+			// Responses are sent in turns regardless
+			if (length != 5) return connection_error(H2Error::FRAME_SIZE_ERROR);
+			break;
+		case H2Frame::RST_STREAM:
+			if (length != 4) return connection_error(H2Error::FRAME_SIZE_ERROR);
+			streams.erase(id);
+			std::erase(ready, id);
+			std::erase(sending, id);
+			break;
+		case H2Frame::SETTINGS:
+			if (id != 0) return connection_error(H2Error::PROTOCOL_ERROR);
+			if (flags & H2_ACK) break;
+			if (length % 6) return connection_error(H2Error::FRAME_SIZE_ERROR);
+			if (!apply_settings(payload)) return false;
+			h2_frame(out, H2Frame::SETTINGS, H2_ACK, 0);
+			break;
+		case H2Frame::PUSH_PROMISE:
+			return connection_error(H2Error::PROTOCOL_ERROR);
+		case H2Frame::PING:
+			if (id != 0) return connection_error(H2Error::PROTOCOL_ERROR);
+			if (length != 8) return connection_error(H2Error::FRAME_SIZE_ERROR);
+			if (!(flags & H2_ACK)) h2_frame(out, H2Frame::PING, H2_ACK, 0, payload);
+			break;
+		case H2Frame::GOAWAY:
+			goaway = true;
+			break;
+		case H2Frame::WINDOW_UPDATE: {
+			if (length != 4) return connection_error(H2Error::FRAME_SIZE_ERROR);
+			uint32_t increment = h2_u32(payload.data()) & 0x7fffffff;
+			if (id == 0) {
+				if (increment == 0) return connection_error(H2Error::PROTOCOL_ERROR);
+				window += increment;
+				if (window > MAX_WINDOW) return connection_error(H2Error::FLOW_CONTROL_ERROR);
+				break;
+			}
+			auto it = streams.find(id);
+			if (it == streams.end()) break;
+			it->second.window += increment;
+			if (increment == 0 || it->second.window > MAX_WINDOW) {
+				stream_error(id, increment ? H2Error::FLOW_CONTROL_ERROR : H2Error::PROTOCOL_ERROR);
+			}
+		} break;
+		default:
+			// Unknown frame types are ignored
+			break;
+		}
+		return true;
+	}
+	
+	// Runs on a worker. Returns nullopt if the request has to be retried with HTTP/1.1.
+	std::optional<http::response<http::string_body>>
+	handle_stream(H2Request &s)
+	{
+		auto error = [this](Status status) {
+			return unprepared_response(*m, find_error_response(*m, status.code).response);
+		};
+		if (s.too_large) return error(413);
+		
+		auto state = std::make_shared<ConnectionState>();
+		state->status_code = 200;
+		state->has_remote = connection->has_remote;
+		state->remote_ip = connection->remote_ip;
+		state->remote_port = connection->remote_port;
+		
+		// 1. Build an HTTP/1 style request head out of the pseudo-header fields. Cookies may come
+		// split in several fields, RFC 7540 8.1.2.5.
+		http::request<http::empty_body> head;
+		head.version(20);
+		std::string_view method, path, authority;
+		std::string cookie;
+		for (auto &[name, value] : s.headers) {
+			if      (name == ":method")    method = value;
+			else if (name == ":path")      path = value;
+			else if (name == ":authority") authority = value;
+			else if (name.starts_with(':')) continue;
+			else if (name == "cookie")     cookie.append(cookie.empty() ? "" : "; ").append(value);
+			else head.insert(name, value);
+		}
+		if (method.empty() || path.empty()) return error(400);
+		head.method_string(method);
+		head.target(path);
+		if (!authority.empty() && head.find(http::field::host) == head.end()) head.set(http::field::host, authority);
+		if (!cookie.empty()) head.set(http::field::cookie, cookie);
+		s.head_request = method == "HEAD";
+		
+		if (expired) return error(503);
+		
+		// 2. The same steps as an HTTP/1 request, without the response cache and coalescing, which
+		// work with serialized HTTP/1 responses
+		state->method = http_method(head.method());
+		if (!load_target(*state, head.target())) return error(400);
+		
+		Status status;
+		uint16_t allowed;
+		const RouterNode::Handler *handler = route_request(*m, *state, status, allowed);
+		if (!handler) {
+			auto response = error(status);
+			if (status.code == 405) {
+				std::string allow = allow_field(allowed);
+				response.set(http::field::allow, std::string_view(allow).substr(7, allow.size() - 9));
+			}
+			return response;
+		}
+		if (handler->fixed) return unprepared_response(*m, handler->fixed->response);
+		
+		std::chrono::seconds retry_after;
+		if (!take_rate_limits(*m, *state, head, retry_after)) {
+			auto response = error(429);
+			response.set(http::field::retry_after, std::to_string(retry_after.count()));
+			return response;
+		}
+		
+		Admission admission;
+		if (!admit(*m, *state, admission)) return error(503);
+		
+		load_head(*state, head);
+		std::string boundary;
+		if (const MultipartConfig *config = find_multipart(*m, *state, boundary)) {
+			// The body's already been buffered, so it's parsed all at once
+			MultipartParser multipart(*config, boundary, state->parts);
+			if (!multipart.feed(s.body.data(), s.body.size()) || !multipart.finish()) return error(multipart.error);
+		} else {
+			state->request_body_stream = std::stringstream(std::move(s.body));
+		}
+		admission.started();
+		call_handler(*m, state, *handler);
+		admission.done();
+		// WebSockets over HTTP/2 (RFC 8441) aren't supported, the client has to use HTTP/1.1
+		if (state->websocket && state->status_code == 200) return error(426);
+		// Neither are event streams, which would keep the stream open indefinitely
+		if (state->event_channel && state->status_code == 200) return std::nullopt;
+		return make_response(*m, *state);
+	}
+	
+	// Hands the stream's request to a worker, whose response comes back to the strand
+	void
+	dispatch(uint32_t id)
+	{
+		H2Stream &s = streams[id];
+		auto request = std::make_shared<H2Request>(std::move(s.headers), std::move(s.body), s.too_large);
+		++handling;
+		boost::asio::post(stream.get_executor(), [c = this->shared_from_this(), id, request] {
+			std::optional<http::response<http::string_body>> response;
+			try {
+				response = c->handle_stream(*request);
+			} catch (const std::exception &e) {
+				c->m->error(std::string("HTTP/2 stream error: ") + e.what());
+				response = unprepared_response(*c->m, find_error_response(*c->m, 500).response);
+			}
+			c->on_strand([c, id, request, response = std::move(response)]() mutable {
+				--c->handling;
+				c->respond(id, *request, std::move(response));
+				c->pump();
+			});
+		});
+	}
+	
+	void
+	respond(uint32_t id, const H2Request &request, std::optional<http::response<http::string_body>> r)
+	{
+		auto it = streams.find(id);
+		// The stream was reset, or the connection is gone
+		if (it == streams.end() || finished) return;
+		H2Stream &s = it->second;
+		if (!r) {
+			stream_error(id, H2Error::HTTP_1_1_REQUIRED);
+			return;
+		}
+		auto &response = *r;
+		
+		// 1. Headers, split into CONTINUATION frames if too large for one. Connection-specific
+		// fields don't exist in HTTP/2.
+		std::string block;
+		encoder.begin(block);
+		encoder.encode(block, ":status", std::to_string(response.result_int()));
+		std::string name;
+		for (auto &field : response) {
+			switch (field.name()) {
+			case http::field::connection:
+			case http::field::keep_alive:
+			case http::field::proxy_connection:
+			case http::field::transfer_encoding:
+			case http::field::upgrade:
+				continue;
+			default:
+				break;
+			}
+			name = field.name_string();
+			for (char &c : name) c = beast::detail::ascii_tolower(c);
+			encoder.encode(block, name, field.value());
+		}
+		bool has_data = !request.head_request && !response.body().empty();
+		std::string_view rest = block;
+		for (bool first = true; first || !rest.empty(); first = false) {
+			std::string_view chunk = rest.substr(0, max_frame_size);
+			rest.remove_prefix(chunk.size());
+			uint8_t flags = (rest.empty() ? H2_END_HEADERS : 0) | (first && !has_data ? H2_END_STREAM : 0);
+			h2_frame(out, first ? H2Frame::HEADERS : H2Frame::CONTINUATION, flags, id, chunk);
+		}
+		
+		// 2. Data, sent by flush_data
+		if (!has_data) {
+			response_done(streams.find(id));
+			return;
+		}
+		s.data = std::move(response.body());
+		sending.push_back(id);
+	}
+	
+	// Sends as much response data as the windows allow, a frame per stream in turns
+	void
+	flush_data()
+	{
+		for (bool progress = true; progress && window > 0;) {
+			progress = false;
+			for (size_t n = sending.size(); n > 0 && window > 0; --n) {
+				uint32_t id = sending.front();
+				sending.pop_front();
+				auto it = streams.find(id);
+				if (it == streams.end()) continue;
+				H2Stream &s = it->second;
+				size_t chunk = std::min<int64_t>({
+					int64_t(s.data.size() - s.sent), s.window, window, int64_t(max_frame_size)
+				});
+				if (s.window <= 0 || chunk == 0) {
+					sending.push_back(id);
+					continue;
+				}
+				bool end = s.sent + chunk == s.data.size();
+				h2_frame(out, H2Frame::DATA, end ? H2_END_STREAM : 0, id, std::string_view(s.data).substr(s.sent, chunk));
+				s.sent += chunk;
+				s.window -= chunk;
+				window -= chunk;
+				progress = true;
+				if (end) {
+					response_done(it);
+				} else {
+					sending.push_back(id);
+				}
+			}
+		}
+	}
+	
+	// Sends what can be sent, hands complete requests to the workers, and finishes the connection
+	// once it's done
+	void
+	pump()
+	{
+		if (finished) return;
+		while (!ready.empty()) {
+			uint32_t id = ready.front();
+			ready.pop_front();
+			dispatch(id);
+		}
+		flush_data();
+		write_out();
+		if (goaway && sending.empty() && handling == 0) finish();
+	}
+	
+	void
+	read()
+	{
+		if (slot && streams.empty()) slot->idle();
+		stream.async_read_some(buffer.prepare(4096), strand_handler(
+			[s = this->shared_from_this()](beast::error_code ec, size_t n) {
+				if (s->finished) return;
+				if (ec) {
+					s->finish();
+					return;
+				}
+				s->buffer.commit(n);
+				if (s->slot) s->slot->active();
+				s->received();
+			}
+		));
+	}
+	
+	// Handles what's been read: the rest of the client connection preface, then whole frames. Then
+	// reads more.
+	void
+	received()
+	{
+		if (!preface.empty()) {
+			if (buffer.size() < preface.size()) {
+				read();
+				return;
+			}
+			if (std::string_view(static_cast<const char *>(buffer.data().data()), preface.size()) != preface) {
+				connection_error(H2Error::PROTOCOL_ERROR);
+				finish();
+				return;
+			}
+			buffer.consume(preface.size());
+			preface = {};
+			
+			// A connection that waited too long for a worker is told to go elsewhere, whatever it
+			// already sent gets a 503
+			if (expired) {
+				std::string payload;
+				h2_append_u32(payload, last_stream_id);
+				h2_append_u32(payload, uint32_t(H2Error::NO_ERROR));
+				h2_frame(out, H2Frame::GOAWAY, 0, 0, payload);
+				goaway = true;
+			}
+		}
+		while (has_frame()) {
+			if (!read_frame()) {
+				finish();
+				return;
+			}
+		}
+		pump();
+		if (!finished) read();
+	}
+	
+public:
+	Http2Connection(std::shared_ptr<ServerState> m_, Stream &&stream_, beast::flat_buffer &&buffer_, std::shared_ptr<const ConnectionState> connection_, std::shared_ptr<ConnectionSlot> slot_, bool expired_)
+	:
+		m(std::move(m_)),
+		stream(std::move(stream_)),
+		strand(stream.get_executor()),
+		buffer(std::move(buffer_)),
+		connection(std::move(connection_)),
+		slot(std::move(slot_)),
+		expired(expired_)
+	{}
+	
+	// Sets up the connection, and goes on on the strand. `upgrade` is only used before it returns.
+	void
+	run(std::string_view preface_, http::request<http::string_body> *upgrade)
+	{
+		// 1. Our settings, the first frame either way. Frames are small and written as soon as
+		// they're ready, and e.g. WINDOW_UPDATE round trips mustn't wait for Nagle's algorithm.
+		if constexpr (requires { beast::get_lowest_layer(stream).expires_never(); }) {
+			beast::get_lowest_layer(stream).expires_never();
+		}
+		if constexpr (requires { beast::get_lowest_layer(stream).socket().set_option(boost::asio::ip::tcp::no_delay(true)); }) {
+			beast::error_code ec;
+			beast::get_lowest_layer(stream).socket().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+		}
+		std::string settings;
+		settings.append("\x00\x03", 2); // SETTINGS_MAX_CONCURRENT_STREAMS
+		h2_append_u32(settings, MAX_CONCURRENT_STREAMS);
+		settings.append("\x00\x06", 2); // SETTINGS_MAX_HEADER_LIST_SIZE
+		h2_append_u32(settings, HpackDecoder::MAX_HEADER_LIST_SIZE);
+		h2_frame(out, H2Frame::SETTINGS, 0, 0, settings);
+		
+		// 2. The request that asked for the upgrade is stream 1, and its HTTP2-Settings are the
+		// client's initial settings
+		bool ok = true;
+		if (upgrade) {
+			std::string client_settings;
+			if (!base64url_decode((*upgrade)[http::field::http2_settings], client_settings) || client_settings.size() % 6) {
+				ok = connection_error(H2Error::PROTOCOL_ERROR);
+			} else {
+				ok = apply_settings(client_settings);
+			}
+		}
+		if (upgrade && ok) {
+			H2Stream &s = streams[1];
+			s.headers.emplace_back(":method", upgrade->method_string());
+			s.headers.emplace_back(":path", upgrade->target());
+			for (auto &field : *upgrade) {
+				switch (field.name()) {
+				case http::field::connection:
+				case http::field::upgrade:
+				case http::field::http2_settings:
+					continue;
+				default:
+					break;
+				}
+				std::string name(field.name_string());
+				for (char &c : name) c = beast::detail::ascii_tolower(c);
+				s.headers.emplace_back(std::move(name), field.value());
+			}
+			s.body = std::move(upgrade->body());
+			s.ended = true;
+			s.window = initial_window;
+			ready.push_back(1);
+			last_stream_id = 1;
+		}
+		
+		// 3. The rest of the client connection preface, then frames until the connection is done
+		preface = preface_;
+		on_strand([c = this->shared_from_this(), ok] {
+			if (!ok) {
+				c->finish();
+				return;
+			}
+			c->write_out();
+			c->received();
+		});
+	}
+};
+
+template<class Stream>
+void
+handle_http2(
+	std::shared_ptr<ServerState> m,
+	Stream &stream,
+	beast::flat_buffer &buffer,
+	std::shared_ptr<const ConnectionState> connection,
+	std::string_view preface,
+	bool expired,
+	std::shared_ptr<ConnectionSlot> slot,
+	http::request<http::string_body> *upgrade
+)
+{
+	auto c = std::make_shared<Http2Connection<Stream>>(
+		std::move(m), std::move(stream), std::move(buffer), std::move(connection), std::move(slot), expired
+	);
+	c->run(preface, upgrade);
+}
+
+}
+
+#endif
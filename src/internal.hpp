@@ -1,9 +1,19 @@
 #ifndef _WOOF_internal_hpp
 #define _WOOF_internal_hpp
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
 #include <sstream>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include <woof/woof.hpp>
 
@@ -23,26 +33,79 @@ struct ParsedTarget {
 	ParsedTarget(const std::string_view &sv);
 };
 
+struct PathParam {
+	int segment;
+	std::string name;
+	uint64_t hash;
+	ParamType type;
+	
+	PathParam(int segment_, std::string name_, ParamType type_ = ParamType::STRING)
+	:
+		segment(segment_),
+		name(std::move(name_)),
+		hash(param_hash(name)),
+		type(type_)
+	{}
+};
+
 struct ConnectionState {
+	// IPv4 addresses are stored IPv4-mapped
+	bool has_remote = false;
+	std::array<uint8_t, 16> remote_ip {};
+	uint16_t remote_port = 0;
 	Method method;
 	ParsedTarget target;
 	std::string target_string_raw;
 	std::string path_string_raw;
 	std::string query_string_raw;
-	std::unordered_map<std::string, std::string> path_params;
+	// Names of the params of whoever is currently being called, the values are path segments
+	const std::vector<PathParam> *path_params = nullptr;
+	// Converted typed params of the endpoint, parallel to its path_params
+	std::vector<ParamValue> param_values;
 	std::unordered_multimap<std::string, std::string> query_params;
 	HeaderMap headers;
 	HeaderMap response_headers;
+	// Pointers to the first value, in arrival order, of each well-known header in `headers`. Kept up
+	// to date by the Request mutators, and checked again after the headers were handed out mutable.
+	std::array<const std::string *, size_t(Field::COUNT)> header_index {};
+	bool header_index_stale = false;
+	std::array<std::string, size_t(Field::COUNT)> response_fields;
+	std::bitset<size_t(Field::COUNT)> response_fields_set;
 	std::stringstream request_body_stream;
+	std::vector<MultipartPart> parts;
 	std::stringstream response_body_stream;
 	Status status_code;
 	std::unordered_map<size_t, MiddlewareI *> mw_map;
+	// Set by a WebSocket endpoint, so that the connection is upgraded instead of responded to
+	std::shared_ptr<const WebSocketHandlers> websocket;
+	// Set by an event stream endpoint
+	std::shared_ptr<EventChannelState> event_channel;
 };
 
+// A FixedResponse serialized once. The Date and Server fields go between `head` and `tail`.
+struct PreparedResponse {
+	FixedResponse response;
+	std::string head; // Status line and fields
+	std::string tail; // The empty line and the body
+};
+
+std::shared_ptr<const PreparedResponse> prepare_response(const FixedResponse &response);
+// The response the server sends itself with the status, see Server::error_response
+const PreparedResponse &find_error_response(const ServerState &m, int status);
+// "Date: <IMF-fixdate>\r\n" for the current second, formatted at most once a second per thread
+std::string_view date_field();
+// The bytes write_prepared would write, for writing to more than one connection
+std::shared_ptr<const std::string> prepared_bytes(const ServerState &m, const PreparedResponse &response, bool head_request, std::string_view extra = {});
+
 struct RouterNode {
 	struct Handler {
-		std::vector<std::pair<int, std::string>> path_params;
+		std::vector<PathParam> path_params;
 		RequestHandler handler;
+		// Set instead of the handler by Server::add_fixed_response
+		std::shared_ptr<const PreparedResponse> fixed {};
+		// A WebSocket or event stream endpoint, which keeps the connection, so its responses can't
+		// be shared
+		bool takes_over = false;
 	};
 	
 	std::weak_ptr<RouterNode> parent;
@@ -54,13 +117,118 @@ struct RouterNode {
 	RouterNode(std::shared_ptr<RouterNode> parent_ = {}) : parent(parent_) {}
 };
 
+class ConnectionSlot;
+
+// The open connections, see Server::max_connections
+struct ConnectionRegistry {
+	std::mutex mutex; // Guards the following
+	size_t max = 0;
+	size_t open = 0;
+	std::list<ConnectionSlot *> idle; // Longest idle first
+	bool paused = false;
+	std::function<void()> resume; // Starts accepting again
+	uint64_t accepted = 0;
+	uint64_t evicted = 0;
+	
+	// Makes room for one more connection by evicting idle ones if needed, and reserves it for the
+	// ConnectionSlot the connection gets next. Returns false if that's not enough, in which case
+	// accepting should pause until `resume` is called.
+	bool make_room();
+};
+
+// See SocketOptions. `tcp` is false for Unix domain sockets.
+void apply_listener_options(const ServerState &m, int fd, bool tcp);
+void apply_connection_options(const ServerState &m, int fd);
+
+// See WorkerAffinity. The CPU of each worker, empty if they aren't pinned.
+struct WorkerCpu {
+	int cpu;
+	int node;
+};
+std::vector<WorkerCpu> plan_worker_cpus(const ServerState &m, int nworkers);
+// Pins the calling thread to the CPU
+void pin_thread(const ServerState &m, const WorkerCpu &cpu);
+
+// Splits a multipart/form-data body into parts as it arrives, see Server::multipart. Delimiters are
+// found with Boyer-Moore-Horspool, and a part's content is only copied once, to memory or a file.
+class MultipartParser {
+	enum class State { PREAMBLE, DELIMITER, HEADERS, BODY, EPILOGUE };
+	
+	const MultipartConfig &config;
+	std::vector<MultipartPart> &parts;
+	const std::string delimiter; // "\r\n--" and the boundary
+	const std::boyer_moore_horspool_searcher<std::string::const_iterator> searcher;
+	State state = State::PREAMBLE;
+	std::string buffer; // Input that's not been consumed yet
+	size_t total = 0;
+	int fd = -1; // The current part's temporary file
+	
+	bool fail(Status status) { error = status; return false; }
+	bool parse_headers(std::string_view headers);
+	bool write(const char *data, size_t size);
+	bool spill();
+	bool end_part();
+	
+public:
+	
+	Status error = 400; // Why feed() or finish() failed
+	
+	MultipartParser(const MultipartConfig &config, std::string_view boundary, std::vector<MultipartPart> &parts);
+	MultipartParser(const MultipartParser &) = delete;
+	~MultipartParser();
+	
+	// Both return false if the body is malformed or over a limit
+	bool feed(const char *data, size_t size);
+	// At the end of the body
+	bool finish();
+};
+
+// The config of the first Server::multipart pattern matching the request, if it has a
+// multipart/form-data body. Needs the request headers.
+const MultipartConfig *find_multipart(const ServerState &m, const ConnectionState &state, std::string &boundary);
+const MultipartConfig *find_multipart(const ServerState &m, const std::vector<std::string> &path_segments, std::string_view content_type, std::string &boundary);
+
+// Counts a connection as open until it's released or goes away, taking over the room reserved by
+// ConnectionRegistry::make_room. Connections start out idle. An
+// evicted connection's socket is shut down, which makes whoever is reading from it fail. It's shared
+// by whoever owns the stream, and has to be released before the socket is closed, or the fd could
+// be reused by another connection while it's still up for eviction.
+class ConnectionSlot {
+	friend ConnectionRegistry;
+	ConnectionRegistry &r;
+	int fd;
+	bool evicted = false;
+	bool released = false;
+	std::list<ConnectionSlot *>::iterator idle_it;
+public:
+	ConnectionSlot(ConnectionRegistry &r, int fd);
+	ConnectionSlot(const ConnectionSlot &) = delete;
+	~ConnectionSlot() { release(); }
+	
+	void idle();
+	void active();
+	void release();
+};
+
+struct Bulkhead {
+	const int max_in_flight;
+	std::atomic<int> in_flight = 0;
+	
+	Bulkhead(int max_in_flight_) : max_in_flight(max_in_flight_) {}
+};
+
 struct ServerState {
 	struct MiddlewareConfig {
 		MiddlewareCreator creator;
 		PathPattern path;
-		std::vector<std::pair<int, std::string>> path_params;
+		std::vector<PathParam> path_params;
 		int idx;
 	};
+	struct CoalesceConfig {
+		PathPattern path;
+		std::vector<std::string> vary;
+		std::chrono::milliseconds timeout;
+	};
 	
 	LogHandler logger;
 	std::string address;
@@ -68,6 +236,29 @@ struct ServerState {
 	std::shared_ptr<RouterNode> router;
 	std::unordered_map<size_t, MiddlewareConfig> mw_map;
 	std::vector<size_t> mw_list;
+	std::optional<std::pair<PathPattern, AsyncLogger>> access_log; // See Server::access_log
+	std::vector<std::pair<PathPattern, std::shared_ptr<ResponseCacheState>>> caches;
+	std::vector<CoalesceConfig> coalesce;
+	std::vector<std::pair<PathPattern, std::shared_ptr<RateLimiterState>>> rate_limits;
+	std::chrono::milliseconds queue_deadline {0};
+	std::shared_ptr<ConcurrencyLimiterState> concurrency_limiter;
+	ConnectionRegistry connections;
+	std::vector<std::pair<PathPattern, std::shared_ptr<Bulkhead>>> bulkheads;
+	std::shared_ptr<TlsState> tls;
+	struct Listener {
+		std::string address; // A Unix domain socket path if port is -1
+		int port;
+		unsigned permissions;
+	};
+	std::vector<Listener> listeners;
+	SocketOptions socket_options;
+	WorkerAffinity worker_affinity;
+	std::unordered_map<int, std::shared_ptr<const PreparedResponse>> error_responses;
+	std::string server_field; // "Server: ...\r\n", or empty
+	std::vector<std::pair<PathPattern, std::shared_ptr<const MultipartConfig>>> multipart;
+	// Keys of the requests being handled by a leader, with the callbacks of the requests waiting
+	std::mutex flights_mutex;
+	std::unordered_map<std::string, std::vector<std::function<void(std::shared_ptr<const std::string>)>>> flights;
 	
 	void log(LogLevel level, const char *s) const        { logger(level, s, strlen(s)); }
 	void log(LogLevel level, const std::string &s) const { logger(level, s.c_str(), s.size()); }
@@ -87,6 +278,325 @@ struct ServerState {
 	void critical(const std::string &s) const { logger(LogLevel::CRITICAL, s.c_str(), s.size()); }
 };
 
+// Indexed by Method
+inline constexpr const char *METHOD_NAMES[] { "-", "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH" };
+
+std::shared_ptr<RouterNode> resolve_pattern(std::shared_ptr<ServerState> m, const PathPattern &path, std::vector<PathParam> &path_param_names);
+// Registers an endpoint, with the handler for the caller to set
+RouterNode::Handler &add_handler(std::shared_ptr<ServerState> m, Method method, const PathPattern &path);
+struct RouteMatch {
+	bool globstar = false;
+	bool rejected = false; // A route matched the path, but its typed params didn't convert
+	uint16_t allowed = 0; // Bits of the methods of the routes that matched the path, but not the method
+	std::vector<ParamValue> param_values;
+};
+
+bool convert_params(const std::vector<PathParam> &params, const std::vector<std::string> &path_segments, std::vector<ParamValue> *values);
+std::shared_ptr<RouterNode> dfs_route(RouteMatch &match, Method method, std::shared_ptr<RouterNode> node, const std::vector<std::string> &path_segments, size_t idx);
+bool match_pattern(const PathPattern &path, const std::vector<std::string> &path_segments);
+void resolve_middlewares(ServerState &m, const std::vector<std::string> &path_segments, std::vector<std::pair<size_t, ServerState::MiddlewareConfig *>> &mw_list);
+
+struct LogSlot {
+	static constexpr size_t TEXT_SIZE = 240;
+	
+	enum class Kind : uint8_t { TEXT, TEXT_CONTINUED, ACCESS };
+	
+	struct Access {
+		Method method;
+		int status;
+		uint64_t bytes;
+		uint64_t latency_ns;
+		char target[TEXT_SIZE - 24];
+	};
+	
+	Kind kind;
+	LogLevel level;
+	uint16_t len;
+	union {
+		char text[TEXT_SIZE];
+		Access access;
+	};
+};
+
+// Single-producer single-consumer ring of log slots. The producer is the thread that registered it,
+// the consumer is the background thread of the AsyncLogState.
+struct LogRing {
+	std::unique_ptr<LogSlot[]> slots;
+	size_t mask;
+	std::atomic<bool> closed = false;
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+	
+	LogRing(size_t capacity) : slots(new LogSlot[capacity]), mask(capacity - 1) {}
+};
+
+struct AsyncLogState {
+	const uint64_t id;
+	const size_t capacity;
+	const LogOverflow overflow;
+	const LogHandler sink;
+	std::atomic<int64_t> interval_ms = 10;
+	std::atomic<uint64_t> dropped = 0;
+	
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::condition_variable flushed_cv;
+	std::vector<std::shared_ptr<LogRing>> rings;
+	uint64_t flush_requested = 0;
+	uint64_t flush_done = 0;
+	std::atomic<bool> wakeup = false;
+	bool stop = false;
+	std::thread thread;
+	
+	AsyncLogState(size_t capacity, LogOverflow overflow, const LogHandler &sink);
+	~AsyncLogState();
+	
+	LogRing &ring();
+	bool acquire(LogRing &ring, size_t n, size_t &tail);
+	void publish(LogRing &ring, size_t tail);
+	void notify();
+	void run();
+};
+
+struct ResponseCacheState {
+	struct Entry {
+		std::string key;
+		std::shared_ptr<const PreparedResponse> response; // Without the Date and Server fields
+		std::chrono::steady_clock::time_point expires;
+		size_t size;
+	};
+	
+	struct alignas(64) Shard {
+		std::mutex mutex;
+		std::list<Entry> lru; // Most recently used first
+		std::unordered_map<std::string_view, std::list<Entry>::iterator> map; // Keys point into the entries
+		size_t bytes = 0;
+	};
+	
+	const size_t shard_max_bytes;
+	const size_t nshards;
+	std::unique_ptr<Shard[]> shards;
+	std::vector<std::string> vary;
+	std::chrono::seconds default_ttl {0};
+	std::atomic<uint64_t> hits = 0;
+	std::atomic<uint64_t> misses = 0;
+	
+	ResponseCacheState(size_t max_bytes, size_t nshards);
+	
+	Shard &shard(std::string_view key) { return shards[std::hash<std::string_view>()(key) % nshards]; }
+	
+	std::shared_ptr<const PreparedResponse> find(std::string_view key);
+	void store(std::string key, std::shared_ptr<const PreparedResponse> response, std::chrono::seconds ttl);
+	// Zero if the response mustn't be stored. `authorization` is whether the request had credentials.
+	std::chrono::seconds ttl(int status, std::string_view cache_control, bool set_cookie, std::string_view vary, bool authorization) const;
+	// From a request's Cache-Control: no-cache means it isn't served from the cache, and no-store
+	// that its response isn't stored either
+	static void request_directives(std::string_view cache_control, bool &serve, bool &store);
+};
+
+struct RateLimiterState {
+	// A bucket's state is packed in 64 bits, so it can be updated with a single CAS: the time of the
+	// last update in milliseconds since `start` in the high bits, and the tokens left in 1/256ths in
+	// the low bits. 0 means unused.
+	static constexpr int TOKEN_BITS = 24;
+	static constexpr uint64_t TOKEN_MASK = (uint64_t(1) << TOKEN_BITS) - 1;
+	static constexpr int TOKEN_ONE = 256;
+	static constexpr size_t PROBES = 16;
+	
+	struct Bucket {
+		std::atomic<uint64_t> key = 0; // 0 means free
+		std::atomic<uint64_t> state = 0;
+	};
+	
+	const double rate_per_ms; // In 1/256ths of a token
+	const uint64_t burst;     // In 1/256ths of a token
+	const size_t mask;
+	std::unique_ptr<Bucket[]> buckets;
+	std::string key_header;
+	const std::chrono::steady_clock::time_point start;
+	std::atomic<uint64_t> limited = 0;
+	
+	RateLimiterState(double rate, double burst, size_t capacity);
+	
+	// Takes a token from the key's bucket. If there's none, returns false and sets how long until
+	// there's one.
+	bool take(uint64_t key, std::chrono::seconds &retry_after);
+};
+
+uint64_t rate_limit_key(std::string_view s);
+
+struct ConcurrencyLimiterState {
+	// Latency samples are averaged over windows of WINDOW requests, the long-term latency is an
+	// exponential moving average over LONG_WINDOW windows
+	static constexpr int WINDOW = 32;
+	static constexpr double LONG_WINDOW = 100;
+	// Latency can be this many times the long-term one before the limit shrinks
+	static constexpr double TOLERANCE = 1.5;
+	static constexpr double SMOOTHING = 0.2;
+	
+	const int min_limit, max_limit;
+	std::atomic<int> limit;
+	std::atomic<int> in_flight = 0;
+	std::atomic<uint64_t> rejected = 0;
+	
+	std::mutex mutex; // Guards the following
+	double estimate;
+	double long_latency = 0;
+	double window_latency = 0;
+	int window_size = 0;
+	int window_max_in_flight = 0;
+	
+	ConcurrencyLimiterState(int initial, int min, int max);
+	
+	// Returns the number of requests in flight including this one, or 0 if it's over the limit
+	int acquire();
+	void release();
+	void sample(std::chrono::steady_clock::duration latency, int in_flight);
+};
+
+// The slots a request takes in the concurrency limiter and the bulkheads, released when it goes
+// away. The handler latency is only sampled if the request got as far as done().
+class Admission {
+	ConcurrencyLimiterState *limiter = nullptr;
+	int in_flight = 0;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration latency {};
+	bool is_done = false;
+	std::vector<Bulkhead *> bulkheads;
+public:
+	Admission() = default;
+	Admission(const Admission &) = delete;
+	~Admission();
+	
+	bool enter(ConcurrencyLimiterState &limiter);
+	bool enter(Bulkhead &bulkhead);
+	// The limiter's latency sample is the time between the two, so that reading the request and
+	// writing the response to a slow client don't count
+	void started() { start = std::chrono::steady_clock::now(); }
+	void done() { latency = std::chrono::steady_clock::now() - start; is_done = true; }
+};
+
+// Held by the leader of a coalesced request. The waiting requests get whatever the leader is
+// answered with, or a 500 if it goes away without a response, e.g. because its handler threw.
+class Flight {
+	ServerState &m;
+	std::string key;
+	bool head_request;
+	bool completed = false;
+public:
+	Flight(ServerState &m_, std::string key_, bool head_request_) : m(m_), key(std::move(key_)), head_request(head_request_) {}
+	Flight(const Flight &) = delete;
+	~Flight();
+	
+	void complete(std::shared_ptr<const std::string> bytes);
+};
+
+// A WebSocket connection, implemented for each stream type in websocket.hpp
+class WebSocketState : public std::enable_shared_from_this<WebSocketState> {
+public:
+	std::shared_ptr<ConnectionState> state;
+	Request request;
+	std::shared_ptr<const WebSocketHandlers> handlers;
+	std::atomic<size_t> queued_bytes = 0;
+	
+	WebSocketState(std::shared_ptr<ConnectionState> state_, std::shared_ptr<const WebSocketHandlers> handlers_)
+	:
+		state(state_),
+		request(state_),
+		handlers(std::move(handlers_))
+	{}
+	virtual ~WebSocketState() = default;
+	
+	// Returns false if the queue is full or the connection is closed
+	virtual bool send(std::shared_ptr<const std::string> message, bool binary) = 0;
+	virtual void close() = 0;
+	// Drops the connection without waiting for the queue
+	virtual void abort() = 0;
+	virtual bool closed() const = 0;
+};
+
+struct WebSocketHubState {
+	std::mutex mutex;
+	std::unordered_map<WebSocketState *, std::weak_ptr<WebSocketState>> subscribers;
+};
+
+// An event stream connection, implemented for each stream type in event_stream.hpp
+class EventSubscriber {
+public:
+	virtual ~EventSubscriber() = default;
+	// Returns false if the subscriber is too far behind
+	virtual bool send(std::shared_ptr<const std::string> event) = 0;
+	virtual void abort() = 0;
+	virtual bool closed() const = 0;
+};
+
+class EventChannelState {
+public:
+	const size_t history;
+	const std::chrono::seconds heartbeat;
+	const size_t max_queued_bytes;
+	
+	std::mutex mutex;
+	uint64_t next_id = 1;
+	std::deque<std::pair<uint64_t, std::shared_ptr<const std::string>>> recent;
+	std::unordered_map<EventSubscriber *, std::weak_ptr<EventSubscriber>> subscribers;
+	
+	EventChannelState(size_t history_, std::chrono::seconds heartbeat_, size_t max_queued_bytes_)
+	:
+		history(history_),
+		heartbeat(heartbeat_),
+		max_queued_bytes(max_queued_bytes_)
+	{}
+	
+	// Sends the recent events after last_id, if any, and subscribes. Both happen under the lock, so
+	// that no event is missed or sent twice.
+	void subscribe(std::shared_ptr<EventSubscriber> subscriber, std::optional<uint64_t> last_id);
+	uint64_t publish(std::string_view data, std::string_view event);
+};
+
+// HPACK (RFC 7541) header compression for HTTP/2. Each direction of a connection has its own
+// dynamic table, so a connection has one of each.
+class HpackDecoder {
+	std::deque<std::pair<std::string, std::string>> table; // Newest first
+	size_t table_size = 0;
+	size_t max_table_size = 4096;
+	
+	bool lookup(uint64_t index, std::string &name, std::string *value) const;
+	void evict(size_t room);
+	void insert(const std::string &name, const std::string &value);
+public:
+	// What we announce as SETTINGS_HEADER_TABLE_SIZE and SETTINGS_MAX_HEADER_LIST_SIZE
+	static constexpr size_t settings_max_table_size = 4096;
+	static constexpr size_t MAX_HEADER_LIST_SIZE = 64 << 10;
+	
+	// Appends the fields of a complete header block. Returns false on a compression error, which is
+	// fatal to the connection.
+	bool decode(std::string_view block, std::vector<std::pair<std::string, std::string>> &headers);
+};
+
+class HpackEncoder {
+	std::deque<std::pair<std::string, std::string>> table; // Newest first
+	size_t table_size = 0;
+	size_t max_size = 4096;
+	bool size_update = false;
+	
+	void evict(size_t room);
+public:
+	// The peer's SETTINGS_HEADER_TABLE_SIZE, announced in the next header block
+	void max_table_size(size_t size);
+	// Call at the start of every header block, before encode
+	void begin(std::string &out);
+	// Names have to be lowercase
+	void encode(std::string &out, std::string_view name, std::string_view value);
+};
+
+Field field_from_beast(unsigned field);
+unsigned beast_field(Field field);
+std::string_view field_name(Field field);
+// Case insensitive
+Field field_from_name(std::string_view name);
+
+const char *log_level_str(LogLevel level);
 void default_log(LogLevel level, const char *str, size_t len);
 
 }
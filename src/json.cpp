@@ -0,0 +1,419 @@
+#include <woof/woof.hpp>
+#include <bit>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace woof {
+
+[[noreturn]] static void
+malformed(const char *what)
+{
+	throw JsonError(std::string("Malformed JSON: ") + what);
+}
+
+static inline const char *
+skip_ws(const char *p, const char *end) noexcept
+{
+	while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+	return p;
+}
+
+// `p` is past the opening quote. Returns the closing quote, and sets `escaped` if there's a
+// backslash before it.
+static const char *
+string_end(const char *p, const char *end, bool &escaped)
+{
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	while (end - p >= 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)));
+		if (!mask) {
+			p += 16;
+			continue;
+		}
+		p += std::countr_zero(mask);
+		if (*p == '"') return p;
+		escaped = true;
+		p += 2;
+	}
+#endif
+	while (p < end) {
+		if (*p == '"') return p;
+		if (*p == '\\') {
+			escaped = true;
+			p += 2;
+			continue;
+		}
+		++p;
+	}
+	malformed("unterminated string");
+}
+
+// `p` is at the opening bracket. Returns past the closing one. Only quotes and brackets are looked
+// at, and brackets are counted without checking that they match.
+static const char *
+container_end(const char *p, const char *end)
+{
+	int depth = 0;
+	while (p < end) {
+#if defined(__SSE2__)
+		if (end - p >= 16) {
+			// '[' and '{', and ']' and '}', only differ by 0x20
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			__m128i folded = _mm_or_si128(x, _mm_set1_epi8(0x20));
+			unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+				_mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')))
+			));
+			if (!mask) {
+				p += 16;
+				continue;
+			}
+			p += std::countr_zero(mask);
+		}
+#endif
+		char c = *p;
+		if (c == '"') {
+			bool escaped;
+			p = string_end(p + 1, end, escaped) + 1;
+			continue;
+		}
+		if (c == '[' || c == '{') {
+			++depth;
+		} else if (c == ']' || c == '}') {
+			if (--depth == 0) return p + 1;
+		}
+		++p;
+	}
+	malformed("unterminated array or object");
+}
+
+// Returns past the value at `p`, which isn't checked
+static const char *
+value_end(const char *p, const char *end)
+{
+	if (p >= end) malformed("missing value");
+	switch (*p) {
+	case '"': {
+		bool escaped;
+		return string_end(p + 1, end, escaped) + 1;
+	}
+	case '[':
+	case '{':
+		return container_end(p, end);
+	default:
+		while (p < end && !strchr(",]} \n\r\t", *p)) ++p;
+		return p;
+	}
+}
+
+static bool
+literal(const char *p, const char *end, std::string_view word)
+{
+	return size_t(end - p) >= word.size() && memcmp(p, word.data(), word.size()) == 0;
+}
+
+static void
+append_utf8(std::string &out, uint32_t c)
+{
+	if (c < 0x80) {
+		out.push_back(char(c));
+	} else if (c < 0x800) {
+		out.push_back(char(0xc0 | c >> 6));
+		out.push_back(char(0x80 | (c & 0x3f)));
+	} else if (c < 0x10000) {
+		out.push_back(char(0xe0 | c >> 12));
+		out.push_back(char(0x80 | (c >> 6 & 0x3f)));
+		out.push_back(char(0x80 | (c & 0x3f)));
+	} else {
+		out.push_back(char(0xf0 | c >> 18));
+		out.push_back(char(0x80 | (c >> 12 & 0x3f)));
+		out.push_back(char(0x80 | (c >> 6 & 0x3f)));
+		out.push_back(char(0x80 | (c & 0x3f)));
+	}
+}
+
+static uint32_t
+hex4(const char *p, const char *end)
+{
+	if (end - p < 4) malformed("truncated \\u escape");
+	uint32_t c = 0;
+	for (int i = 0; i < 4; ++i) {
+		char h = p[i];
+		c <<= 4;
+		if      (h >= '0' && h <= '9') c |= h - '0';
+		else if (h >= 'a' && h <= 'f') c |= h - 'a' + 10;
+		else if (h >= 'A' && h <= 'F') c |= h - 'A' + 10;
+		else malformed("bad \\u escape");
+	}
+	return c;
+}
+
+// Decodes the inside of a string with escapes
+static void
+decode_string(const char *p, const char *end, std::string &out)
+{
+	out.clear();
+	while (p < end) {
+		const char *run = p;
+		while (p < end && *p != '\\' && uint8_t(*p) >= 0x20) ++p;
+		out.append(run, p);
+		if (p == end) break;
+		if (*p != '\\') malformed("control character in string");
+		if (++p == end) malformed("truncated escape");
+		switch (*p++) {
+		case '"':  out.push_back('"'); break;
+		case '\\': out.push_back('\\'); break;
+		case '/':  out.push_back('/'); break;
+		case 'b':  out.push_back('\b'); break;
+		case 'f':  out.push_back('\f'); break;
+		case 'n':  out.push_back('\n'); break;
+		case 'r':  out.push_back('\r'); break;
+		case 't':  out.push_back('\t'); break;
+		case 'u': {
+			uint32_t c = hex4(p, end);
+			p += 4;
+			if (c >= 0xd800 && c < 0xdc00) {
+				if (!literal(p, end, "\\u")) malformed("lone surrogate");
+				uint32_t low = hex4(p + 2, end);
+				if (low < 0xdc00 || low >= 0xe000) malformed("lone surrogate");
+				p += 6;
+				c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+			} else if (c >= 0xdc00 && c < 0xe000) {
+				malformed("lone surrogate");
+			}
+			append_utf8(out, c);
+		} break;
+		default:
+			malformed("bad escape");
+		}
+	}
+}
+
+JsonValue::JsonValue(std::string_view document)
+:
+	p(skip_ws(document.data(), document.data() + document.size())),
+	end(document.data() + document.size())
+{}
+
+JsonType
+JsonValue::type() const
+{
+	if (!p || p >= end) malformed("missing value");
+	switch (*p) {
+	case 'n':
+		if (!literal(p, end, "null")) break;
+		return JsonType::NIL;
+	case 't':
+		if (!literal(p, end, "true")) break;
+		return JsonType::BOOLEAN;
+	case 'f':
+		if (!literal(p, end, "false")) break;
+		return JsonType::BOOLEAN;
+	case '"': return JsonType::STRING;
+	case '[': return JsonType::ARRAY;
+	case '{': return JsonType::OBJECT;
+	case '-':
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		return JsonType::NUMBER;
+	}
+	malformed("unexpected character");
+}
+
+std::string_view
+JsonValue::raw() const
+{
+	if (!p) malformed("missing value");
+	return {p, size_t(value_end(p, end) - p)};
+}
+
+std::string_view
+JsonValue::string(std::string &buf) const
+{
+	if (type() != JsonType::STRING) throw JsonError("Expected a JSON string");
+	bool escaped = false;
+	const char *q = string_end(p + 1, end, escaped);
+	if (!escaped) return {p + 1, size_t(q - p - 1)};
+	decode_string(p + 1, q, buf);
+	return buf;
+}
+
+std::string
+JsonValue::string() const
+{
+	std::string buf;
+	std::string_view s = string(buf);
+	return s.data() == buf.data() ? std::move(buf) : std::string(s);
+}
+
+std::string_view
+JsonValue::number() const
+{
+	if (type() != JsonType::NUMBER) throw JsonError("Expected a JSON number");
+	auto digits = [this](const char *q) {
+		while (q < end && *q >= '0' && *q <= '9') ++q;
+		return q;
+	};
+	const char *q = p;
+	if (*q == '-') ++q;
+	if (q < end && *q == '0') {
+		++q;
+	} else {
+		const char *d = digits(q);
+		if (d == q) malformed("bad number");
+		q = d;
+	}
+	if (q < end && *q == '.') {
+		const char *d = digits(q + 1);
+		if (d == q + 1) malformed("bad number");
+		q = d;
+	}
+	if (q < end && (*q == 'e' || *q == 'E')) {
+		++q;
+		if (q < end && (*q == '+' || *q == '-')) ++q;
+		const char *d = digits(q);
+		if (d == q) malformed("bad number");
+		q = d;
+	}
+	if (q < end && !strchr(",]} \n\r\t", *q)) malformed("bad number");
+	return {p, size_t(q - p)};
+}
+
+bool
+JsonValue::boolean() const
+{
+	if (type() != JsonType::BOOLEAN) throw JsonError("Expected a JSON boolean");
+	return *p == 't';
+}
+
+const char *
+JsonValue::begin_container(char open) const
+{
+	if (!p || p >= end || *p != open) throw JsonError(open == '[' ? "Expected a JSON array" : "Expected a JSON object");
+	const char *q = skip_ws(p + 1, end);
+	if (q < end && *q == open + 2) return nullptr;
+	return q;
+}
+
+const char *
+JsonValue::next_element(const char *q, char close) const
+{
+	q = skip_ws(value_end(q, end), end);
+	if (q < end && *q == ',') return skip_ws(q + 1, end);
+	if (q < end && *q == close) return nullptr;
+	malformed(close == ']' ? "expected ',' or ']'" : "expected ',' or '}'");
+}
+
+const char *
+JsonValue::member_value(const char *q, std::string_view &key) const
+{
+	if (q >= end || *q != '"') malformed("expected a key");
+	bool escaped;
+	const char *e = string_end(q + 1, end, escaped);
+	key = {q, size_t(e + 1 - q)};
+	q = skip_ws(e + 1, end);
+	if (q >= end || *q != ':') malformed("expected ':'");
+	return skip_ws(q + 1, end);
+}
+
+std::optional<JsonValue>
+JsonValue::find(std::string_view key) const
+{
+	std::string buf;
+	const char *q = begin_container('{');
+	while (q) {
+		std::string_view raw_key;
+		const char *value = member_value(q, raw_key);
+		std::string_view k = raw_key.substr(1, raw_key.size() - 2);
+		if (k.find('\\') != std::string_view::npos) {
+			decode_string(k.data(), k.data() + k.size(), buf);
+			k = buf;
+		}
+		if (k == key) return JsonValue(value, end);
+		q = next_element(value, '}');
+	}
+	return {};
+}
+
+JsonValue
+JsonValue::operator[](std::string_view key) const
+{
+	auto value = find(key);
+	if (!value) throw JsonError("Missing JSON key: " + std::string(key));
+	return *value;
+}
+
+JsonValue
+JsonValue::operator[](size_t idx) const
+{
+	const char *q = begin_container('[');
+	for (; q; q = next_element(q, ']')) {
+		if (idx-- == 0) return JsonValue(q, end);
+	}
+	throw JsonError("JSON array index out of range");
+}
+
+size_t
+JsonValue::size() const
+{
+	size_t n = 0;
+	if (type() == JsonType::ARRAY) {
+		for_each([&n](JsonValue) { ++n; });
+	} else {
+		for_each_member([&n](std::string_view, JsonValue) { ++n; });
+	}
+	return n;
+}
+
+void
+JsonWriter::write_string(std::string_view s)
+{
+	static constexpr char hex[] = "0123456789abcdef";
+	out->sputc('"');
+	const char *p = s.data(), *end = p + s.size();
+	while (p < end) {
+		// Copy the run of characters that don't need escaping in one go
+		const char *run = p;
+#if defined(__SSE2__)
+		while (end - p >= 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			__m128i special = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))),
+				_mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1f)), x)
+			);
+			unsigned mask = _mm_movemask_epi8(special);
+			if (mask) {
+				p += std::countr_zero(mask);
+				goto found;
+			}
+			p += 16;
+		}
+#endif
+		while (p < end && *p != '"' && *p != '\\' && uint8_t(*p) >= 0x20) ++p;
+#if defined(__SSE2__)
+	found:
+#endif
+		out->sputn(run, p - run);
+		if (p == end) break;
+		char c = *p++;
+		switch (c) {
+		case '"':  out->sputn("\\\"", 2); break;
+		case '\\': out->sputn("\\\\", 2); break;
+		case '\n': out->sputn("\\n", 2); break;
+		case '\r': out->sputn("\\r", 2); break;
+		case '\t': out->sputn("\\t", 2); break;
+		default: {
+			char escape[6] = {'\\', 'u', '0', '0', hex[uint8_t(c) >> 4], hex[c & 0xf]};
+			out->sputn(escape, 6);
+		}
+		}
+	}
+	out->sputc('"');
+}
+
+}
@@ -0,0 +1,374 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace woof {
+
+namespace fs = std::filesystem;
+
+void
+Server::multipart(const MultipartConfig &config, const PathPattern &path)
+{
+	m->multipart.emplace_back(path, std::make_shared<const MultipartConfig>(config));
+}
+
+MultipartPart::MultipartPart(MultipartPart &&other) noexcept
+:
+	m_headers(std::move(other.m_headers)),
+	m_name(std::move(other.m_name)),
+	m_filename(std::move(other.m_filename)),
+	m_data(std::move(other.m_data)),
+	m_path(std::exchange(other.m_path, {})),
+	m_temporary(std::exchange(other.m_temporary, false)),
+	m_size(other.m_size)
+{}
+
+MultipartPart &
+MultipartPart::operator=(MultipartPart &&other) noexcept
+{
+	if (this != &other) {
+		if (m_temporary) ::unlink(m_path.c_str());
+		m_headers = std::move(other.m_headers);
+		m_name = std::move(other.m_name);
+		m_filename = std::move(other.m_filename);
+		m_data = std::move(other.m_data);
+		m_path = std::exchange(other.m_path, {});
+		m_temporary = std::exchange(other.m_temporary, false);
+		m_size = other.m_size;
+	}
+	return *this;
+}
+
+MultipartPart::~MultipartPart()
+{
+	if (m_temporary) ::unlink(m_path.c_str());
+}
+
+std::string_view
+MultipartPart::content_type() const
+{
+	auto it = m_headers.find("Content-Type");
+	return it != m_headers.end() ? std::string_view(it->second) : "text/plain";
+}
+
+std::unique_ptr<std::istream>
+MultipartPart::stream() const
+{
+	if (in_memory()) return std::make_unique<std::istringstream>(m_data);
+	return std::make_unique<std::ifstream>(m_path, std::ios::binary);
+}
+
+void
+MultipartPart::save(const std::string &path)
+{
+	std::error_code ec;
+	bool renamed = false;
+	if (in_memory()) {
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(m_data.data(), m_data.size());
+		out.close();
+		if (!out) ec = std::make_error_code(std::errc::io_error);
+	} else {
+		fs::rename(m_path, path, ec);
+		renamed = !ec;
+		// The temporary directory can be on another file system
+		if (ec) fs::copy_file(m_path, path, fs::copy_options::overwrite_existing, ec);
+	}
+	// The part is left as it was
+	if (ec) throw fs::filesystem_error("Couldn't save the part", path, ec);
+	if (in_memory()) return;
+	if (!renamed && m_temporary) ::unlink(m_path.c_str());
+	m_path = path;
+	m_temporary = false;
+}
+
+// Splits "form-data; name=\"a\"; filename=\"b\"" into its parameters. Quoted values can have
+// backslash escapes. Names are lowercased.
+static std::vector<std::pair<std::string, std::string>>
+header_params(std::string_view value)
+{
+	std::vector<std::pair<std::string, std::string>> params;
+	auto skip_space = [&value] {
+		while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+	};
+	size_t semicolon = value.find(';');
+	if (semicolon == std::string_view::npos) return params;
+	value.remove_prefix(semicolon + 1);
+	while (!value.empty()) {
+		skip_space();
+		size_t end = value.find_first_of("=;");
+		std::string name(value.substr(0, end));
+		while (!name.empty() && (name.back() == ' ' || name.back() == '\t')) name.pop_back();
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+		std::string v;
+		if (end != std::string_view::npos && value[end] == '=') {
+			value.remove_prefix(end + 1);
+			skip_space();
+			if (!value.empty() && value.front() == '"') {
+				size_t i = 1;
+				for (; i < value.size() && value[i] != '"'; ++i) {
+					if (value[i] == '\\' && i + 1 < value.size()) ++i;
+					v.push_back(value[i]);
+				}
+				value.remove_prefix(std::min(i + 1, value.size()));
+				end = value.find(';');
+			} else {
+				end = value.find(';');
+				v = value.substr(0, end);
+				while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.pop_back();
+			}
+		}
+		if (!name.empty()) params.emplace_back(std::move(name), std::move(v));
+		if (end == std::string_view::npos) break;
+		value.remove_prefix(end + 1);
+	}
+	return params;
+}
+
+// The boundary parameter of a multipart/form-data type, empty if it's another type or there's no
+// valid boundary
+static std::string
+multipart_boundary(std::string_view content_type)
+{
+	std::string_view type = content_type.substr(0, content_type.find(';'));
+	while (!type.empty() && (type.back() == ' ' || type.back() == '\t')) type.remove_suffix(1);
+	if (!CaseInsensitiveEquals()(type, "multipart/form-data")) return {};
+	for (auto &[name, value] : header_params(content_type)) {
+		// RFC 2046 5.1.1
+		if (name == "boundary") return value.size() <= 70 ? value : std::string();
+	}
+	return {};
+}
+
+const MultipartConfig *
+find_multipart(const ServerState &m, const std::vector<std::string> &path_segments, std::string_view content_type, std::string &boundary)
+{
+	for (auto &[path, config] : m.multipart) {
+		if (!match_pattern(path, path_segments)) continue;
+		boundary = multipart_boundary(content_type);
+		return boundary.empty() ? nullptr : config.get();
+	}
+	return nullptr;
+}
+
+const MultipartConfig *
+find_multipart(const ServerState &m, const ConnectionState &state, std::string &boundary)
+{
+	if (m.multipart.empty()) return nullptr;
+	auto it = state.headers.find("Content-Type");
+	if (it == state.headers.end()) return nullptr;
+	return find_multipart(m, state.target.path_segments, it->second, boundary);
+}
+
+MultipartParser::MultipartParser(const MultipartConfig &config_, std::string_view boundary, std::vector<MultipartPart> &parts_)
+:
+	config(config_),
+	parts(parts_),
+	delimiter("\r\n--" + std::string(boundary)),
+	searcher(delimiter.begin(), delimiter.end()),
+	// The first delimiter can be at the very start, without the CRLF before it
+	buffer("\r\n")
+{}
+
+MultipartParser::~MultipartParser()
+{
+	if (fd != -1) ::close(fd);
+}
+
+bool
+MultipartParser::feed(const char *data, size_t size)
+{
+	total += size;
+	if (total > config.max_size) return fail(413);
+	if (state == State::EPILOGUE) return true;
+	buffer.append(data, size);
+	size_t consumed = 0;
+	// The rest of the buffer, once `consumed` bytes have been dealt with
+	auto rest = [&] { return std::string_view(buffer).substr(consumed); };
+	auto find_delimiter = [&] {
+		auto it = std::search(buffer.cbegin() + consumed, buffer.cend(), searcher);
+		return it == buffer.cend() ? std::string_view::npos : size_t(it - buffer.cbegin()) - consumed;
+	};
+	bool more = true;
+	while (more) {
+		switch (state) {
+		case State::PREAMBLE: {
+			size_t pos = find_delimiter();
+			if (pos == std::string_view::npos) {
+				// The delimiter can start in what's kept
+				consumed = std::max(consumed, buffer.size() - std::min(buffer.size(), delimiter.size() - 1));
+				more = false;
+				break;
+			}
+			consumed += pos + delimiter.size();
+			state = State::DELIMITER;
+			break;
+		}
+		case State::DELIMITER: {
+			// "--" after the last one, otherwise optional whitespace and CRLF
+			std::string_view s = rest();
+			if (s.size() < 2) {
+				more = false;
+				break;
+			}
+			if (s.starts_with("--")) {
+				state = State::EPILOGUE;
+				more = false;
+				break;
+			}
+			size_t crlf = s.find("\r\n");
+			if (crlf == std::string_view::npos) {
+				// Wait for the rest of the line, unless it can't be whitespace
+				std::string_view padding = s.substr(0, s.size() - s.ends_with('\r'));
+				if (padding.find_first_not_of(" \t") != std::string_view::npos || s.size() > 256) return fail(400);
+				more = false;
+				break;
+			}
+			if (s.substr(0, crlf).find_first_not_of(" \t") != std::string_view::npos) return fail(400);
+			consumed += crlf + 2;
+			if (parts.size() >= config.max_parts) return fail(413);
+			parts.emplace_back();
+			state = State::HEADERS;
+			break;
+		}
+		case State::HEADERS: {
+			std::string_view s = rest();
+			size_t end = s.starts_with("\r\n") ? 0 : s.find("\r\n\r\n");
+			if (end == std::string_view::npos) {
+				if (s.size() > config.max_header_size) return fail(413);
+				more = false;
+				break;
+			}
+			if (end > config.max_header_size) return fail(413);
+			if (!parse_headers(s.substr(0, end))) return false;
+			consumed += end == 0 ? 2 : end + 4;
+			state = State::BODY;
+			break;
+		}
+		case State::BODY: {
+			size_t pos = find_delimiter();
+			if (pos == std::string_view::npos) {
+				// Keep what could be the start of the delimiter
+				size_t keep = std::min(rest().size(), delimiter.size() - 1);
+				if (!write(buffer.data() + consumed, rest().size() - keep)) return false;
+				consumed = buffer.size() - keep;
+				more = false;
+				break;
+			}
+			if (!write(buffer.data() + consumed, pos) || !end_part()) return false;
+			consumed += pos + delimiter.size();
+			state = State::DELIMITER;
+			break;
+		}
+		case State::EPILOGUE:
+			more = false;
+			break;
+		}
+	}
+	buffer.erase(0, consumed);
+	return true;
+}
+
+bool
+MultipartParser::finish()
+{
+	buffer.clear();
+	return state == State::EPILOGUE || fail(400);
+}
+
+bool
+MultipartParser::parse_headers(std::string_view headers)
+{
+	MultipartPart &part = parts.back();
+	while (!headers.empty()) {
+		size_t end = headers.find("\r\n");
+		std::string_view line = headers.substr(0, end);
+		headers = end == std::string_view::npos ? std::string_view() : headers.substr(end + 2);
+		size_t colon = line.find(':');
+		if (colon == 0 || colon == std::string_view::npos) return fail(400);
+		std::string_view value = line.substr(colon + 1);
+		size_t first = value.find_first_not_of(" \t");
+		value = first == std::string_view::npos ? std::string_view() : value.substr(first, value.find_last_not_of(" \t") - first + 1);
+		part.m_headers.emplace(line.substr(0, colon), value);
+	}
+	// RFC 7578 4.2: every part has a name
+	auto it = part.m_headers.find("Content-Disposition");
+	if (it == part.m_headers.end()) return fail(400);
+	std::string_view type = std::string_view(it->second).substr(0, it->second.find(';'));
+	while (!type.empty() && (type.back() == ' ' || type.back() == '\t')) type.remove_suffix(1);
+	if (!CaseInsensitiveEquals()(type, "form-data")) return fail(400);
+	bool named = false;
+	for (auto &[name, value] : header_params(it->second)) {
+		if (name == "name") {
+			part.m_name = std::move(value);
+			named = true;
+		} else if (name == "filename") {
+			part.m_filename = std::move(value);
+		}
+	}
+	return named || fail(400);
+}
+
+static bool
+write_all(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool
+MultipartParser::write(const char *data, size_t size)
+{
+	if (size == 0) return true;
+	MultipartPart &part = parts.back();
+	part.m_size += size;
+	if (part.m_size > config.max_part_size) return fail(413);
+	if (fd == -1 && part.m_size > config.memory_threshold && !spill()) return false;
+	if (fd == -1) {
+		part.m_data.append(data, size);
+		return true;
+	}
+	return write_all(fd, data, size) || fail(500);
+}
+
+// Moves what's been written of the current part to a temporary file, where the rest goes
+bool
+MultipartParser::spill()
+{
+	MultipartPart &part = parts.back();
+	std::string directory = config.temp_directory;
+	if (directory.empty()) {
+		const char *tmpdir = std::getenv("TMPDIR");
+		directory = tmpdir && *tmpdir ? tmpdir : "/tmp";
+	}
+	std::string path = directory + "/woof-XXXXXX";
+	fd = ::mkstemp(path.data());
+	if (fd == -1) return fail(500);
+	part.m_path = std::move(path);
+	part.m_temporary = true;
+	if (!write_all(fd, part.m_data.data(), part.m_data.size())) return fail(500);
+	std::string().swap(part.m_data);
+	return true;
+}
+
+bool
+MultipartParser::end_part()
+{
+	if (fd == -1) return true;
+	int err = ::close(fd);
+	fd = -1;
+	return err == 0 || fail(500);
+}
+
+}
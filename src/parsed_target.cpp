@@ -54,9 +54,9 @@ namespace woof {
 static constexpr unsigned char
 quartet_from_hex_char(char c) noexcept
 {
-	if (c >= '0' || c <= '9') return c - '0';
-	if (c >= 'A' || c <= 'F') return c - 'A' + 10;
-	if (c >= 'a' || c <= 'f') return c - 'a' + 10;
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
 	return 16;
 }
 
@@ -66,10 +66,34 @@ decode_percent(const char percent[2]) noexcept
 	unsigned char high = quartet_from_hex_char(percent[0]);
 	unsigned char low  = quartet_from_hex_char(percent[1]);
 	if (high > 15 || low > 15) return std::numeric_limits<char>::max() + 1;
-	unsigned char c = (high << 4) & low;
+	unsigned char c = (high << 4) | low;
 	return *reinterpret_cast<char *>(&c);
 }
 
+bool
+form_decode(std::string_view &s, std::string &buf)
+{
+	size_t idx = s.find_first_of("%+");
+	if (idx == std::string_view::npos) return true;
+	buf.assign(s, 0, idx);
+	for (; idx < s.size(); ++idx) {
+		char c = s[idx];
+		if (c == '+') {
+			buf.push_back(' ');
+		} else if (c == '%') {
+			if (s.size() - idx < 3) return false;
+			int ch = decode_percent(&s[idx + 1]);
+			if (ch > std::numeric_limits<char>::max()) return false;
+			buf.push_back(ch);
+			idx += 2;
+		} else {
+			buf.push_back(c);
+		}
+	}
+	s = buf;
+	return true;
+}
+
 ParsedTarget::ParsedTarget(const std::string_view &sv)
 {
 	const size_t sz = sv.size();
@@ -101,8 +125,15 @@ ParsedTarget::ParsedTarget(const std::string_view &sv)
 				success = false;
 				return;
 			}
-			buf.push_back(ch);
+			// A decoded character is never a delimiter
+			decoded.push_back(ch);
+			switch (state) {
+			case STATE_PATH:        path.push_back(ch);  buf.push_back(ch);  break;
+			case STATE_QUERY_NAME:  query.push_back(ch); buf.push_back(ch);  break;
+			case STATE_QUERY_VALUE: query.push_back(ch); buf2.push_back(ch); break;
+			}
 			percent_state = PERCENT_NONE;
+			continue;
 		} break;
 		}
 		
@@ -1,7 +1,22 @@
 #include "internal.hpp"
+#include <stdexcept>
 
 namespace woof {
 
+PathPattern::Segment
+PathPattern::Segment::param(std::string_view spec)
+{
+	Segment segment {true, std::string(spec)};
+	size_t colon = spec.find(':');
+	if (colon != std::string_view::npos) {
+		segment.name.resize(colon);
+		if (!parse_param_type(spec.substr(colon + 1), segment.type)) {
+			throw std::invalid_argument("Unknown path param type: " + std::string(spec.substr(colon + 1)));
+		}
+	}
+	return segment;
+}
+
 // A state machine parser for path patterns. See <woof/path_pattern_sfinae.hpp> for more info.
 
 PathPattern
@@ -13,8 +28,8 @@ PathPattern::make(const std::string &pattern)
 	
 	PathPattern pp;
 	
-	for (size_t idx = pattern[0] == '/'; idx < sz; ++idx) {
-		const char c = pattern[idx];
+	for (size_t idx = pattern[0] == '/'; idx <= sz; ++idx) {
+		const char c = idx < sz ? pattern[idx] : '\0';
 		
 		switch (state) {
 		case State::SLASH: {
@@ -47,13 +62,15 @@ PathPattern::make(const std::string &pattern)
 				state = State::RBRACE;
 			} else {
 				buf.push_back(c);
+				state = State::IN_NAME;
 			}
 		} break;
 		case State::IN_NAME: {
 			if (c == '\0') {
 				// TODO error
 			} else if (c == '}') {
-				pp.segments.push_back({true, std::move(buf)});
+				pp.segments.push_back(Segment::param(buf));
+				buf.clear();
 				state = State::RBRACE;
 			} else {
 				buf.push_back(c);
@@ -0,0 +1,105 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace woof {
+
+RateLimiterState::RateLimiterState(double rate, double burst_, size_t capacity)
+:
+	rate_per_ms(rate * TOKEN_ONE / 1000),
+	burst(std::clamp<uint64_t>(burst_ * TOKEN_ONE, TOKEN_ONE, TOKEN_MASK)),
+	mask(std::bit_ceil(std::max(capacity, PROBES)) - 1),
+	buckets(new Bucket[mask + 1]),
+	start(std::chrono::steady_clock::now())
+{}
+
+bool
+RateLimiterState::take(uint64_t key, std::chrono::seconds &retry_after)
+{
+	// +1 so that a state is never 0
+	uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() + 1;
+	
+	auto refill = [this, now](uint64_t state) -> uint64_t {
+		if (state == 0) return burst;
+		uint64_t last = state >> TOKEN_BITS;
+		uint64_t tokens = state & TOKEN_MASK;
+		double refilled = tokens + (now > last ? now - last : 0) * rate_per_ms;
+		return refilled >= burst ? burst : uint64_t(refilled);
+	};
+	
+	// 1. Find the key's bucket, or claim a free one, or one that's full again
+	Bucket *bucket = nullptr;
+	for (size_t i = 0; i < PROBES && !bucket; ++i) {
+		Bucket &b = buckets[(key + i) & mask];
+		uint64_t k = b.key.load(std::memory_order_acquire);
+		if (k == key) {
+			bucket = &b;
+		} else if (k == 0) {
+			if (b.key.compare_exchange_strong(k, key, std::memory_order_acq_rel) || k == key) {
+				bucket = &b;
+			}
+		}
+	}
+	for (size_t i = 0; i < PROBES && !bucket; ++i) {
+		Bucket &b = buckets[(key + i) & mask];
+		uint64_t state = b.state.load(std::memory_order_acquire);
+		if (refill(state) < burst) continue;
+		uint64_t k = b.key.load(std::memory_order_acquire);
+		if (b.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+			// Unconditionally, the old client may have taken a token since the state was loaded
+			b.state.store(0, std::memory_order_release);
+			bucket = &b;
+		}
+	}
+	if (!bucket) return true;
+	
+	// 2. Refill lazily and take a token
+	uint64_t state = bucket->state.load(std::memory_order_acquire);
+	for (;;) {
+		uint64_t tokens = refill(state);
+		if (tokens < TOKEN_ONE) {
+			double ms = rate_per_ms > 0 ? (TOKEN_ONE - tokens) / rate_per_ms : 1e9;
+			retry_after = std::chrono::seconds(std::max<int64_t>(1, std::ceil(ms / 1000)));
+			limited.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		uint64_t next = now << TOKEN_BITS | (tokens - TOKEN_ONE);
+		if (bucket->state.compare_exchange_weak(state, next, std::memory_order_acq_rel)) {
+			return true;
+		}
+	}
+}
+
+uint64_t
+rate_limit_key(std::string_view s)
+{
+	uint64_t h = std::hash<std::string_view>()(s);
+	return h ? h : 1;
+}
+
+RateLimiter::RateLimiter(double rate, double burst, size_t capacity)
+:
+	m(std::make_shared<RateLimiterState>(rate, burst, capacity))
+{}
+
+RateLimiter &
+RateLimiter::key_header(const std::string &name)
+{
+	m->key_header = name;
+	return *this;
+}
+
+uint64_t
+RateLimiter::limited() const
+{
+	return m->limited.load(std::memory_order_relaxed);
+}
+
+void
+Server::rate_limit(const RateLimiter &limiter, const PathPattern &path)
+{
+	m->rate_limits.emplace_back(path, limiter.m);
+}
+
+}
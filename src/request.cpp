@@ -1,29 +1,73 @@
 #include "internal.hpp"
+#include <boost/asio/ip/address.hpp>
 
 namespace woof {
 
-std::unordered_map<std::string, std::string> &
-Request::Path::map()
+const std::string &
+Request::Path::string() const
+{
+	return m->target.path;
+}
+
+const std::string &
+Request::Path::string_raw() const
+{
+	return m->path_string_raw;
+}
+
+size_t
+Request::Path::size() const
+{
+	return m->path_params ? m->path_params->size() : 0;
+}
+
+std::string_view
+Request::Path::name(size_t idx) const
 {
-	return m->path_params;
+	if (idx >= size()) throw std::out_of_range("No such path param");
+	return (*m->path_params)[idx].name;
 }
 
-const std::unordered_map<std::string, std::string> &
+std::string_view
+Request::Path::operator[](size_t idx) const
+{
+	if (idx >= size()) throw std::out_of_range("No such path param");
+	return m->target.path_segments[(*m->path_params)[idx].segment];
+}
+
+std::string_view
+Request::Path::operator[](std::string_view key) const
+{
+	std::optional<std::string_view> sv = find(param_hash(key), key);
+	if (!sv) throw std::out_of_range("No such path param");
+	return *sv;
+}
+
+std::unordered_map<std::string, std::string>
 Request::Path::map() const
 {
-	return m->path_params;
+	std::unordered_map<std::string, std::string> params;
+	for (size_t i = 0; i < size(); ++i) params.emplace(name(i), (*this)[i]);
+	return params;
 }
 
-const std::string &
-Request::Path::string() const
+ParamValue
+Request::Path::value(size_t idx) const
 {
-	return m->target.path;
+	if (idx >= m->param_values.size()) throw std::out_of_range("No such path param");
+	return m->param_values[idx];
 }
 
-const std::string &
-Request::Path::string_raw() const
+std::optional<std::string_view>
+Request::Path::find(uint64_t hash, std::string_view key) const
 {
-	return m->path_string_raw;
+	if (!m->path_params) return {};
+	for (auto &p : *m->path_params) {
+		if (p.hash == hash && p.name == key) {
+			return m->target.path_segments[p.segment];
+		}
+	}
+	return {};
 }
 
 std::unordered_multimap<std::string, std::string> &
@@ -62,12 +106,60 @@ Request::Body::stream() const
 	return m->request_body_stream;
 }
 
+// application/json, or any type with the +json suffix, with any parameters
+static bool
+is_json_type(std::string_view type)
+{
+	type = type.substr(0, type.find(';'));
+	while (!type.empty() && (type.back() == ' ' || type.back() == '\t')) type.remove_suffix(1);
+	CaseInsensitiveEquals equals;
+	return equals(type, "application/json")
+		|| (type.size() > 5 && equals(type.substr(type.size() - 5), "+json"));
+}
+
+JsonValue
+Request::json() const
+{
+	const std::string *type = header(Field::CONTENT_TYPE);
+	if (type && !is_json_type(*type)) throw JsonError("Expected a JSON request body", 415);
+	return JsonValue(m->request_body_stream.view());
+}
+
+std::vector<MultipartPart> &
+Request::parts()
+{
+	return m->parts;
+}
+
+const std::vector<MultipartPart> &
+Request::parts() const
+{
+	return m->parts;
+}
+
 Method
 Request::method() const
 {
 	return m->method;
 }
 
+std::string
+Request::remote_address() const
+{
+	if (!m->has_remote) return {};
+	auto address = boost::asio::ip::make_address_v6(m->remote_ip);
+	if (address.is_v4_mapped()) {
+		return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address).to_string();
+	}
+	return address.to_string();
+}
+
+int
+Request::remote_port() const
+{
+	return m->remote_port;
+}
+
 const std::string &
 Request::target_string() const
 {
@@ -83,6 +175,7 @@ Request::target_string_raw() const
 HeaderMap &
 Request::headers()
 {
+	m->header_index_stale = true;
 	return m->headers;
 }
 
@@ -92,6 +185,58 @@ Request::headers() const
 	return m->headers;
 }
 
+// After the headers were changed directly: the values still there stay first, since the map doesn't
+// keep the order of repeated headers. Otherwise the first one found takes their place.
+static void
+reindex_headers(ConnectionState &state)
+{
+	std::array<const std::string *, size_t(Field::COUNT)> index {};
+	for (auto &[name, value] : state.headers) {
+		Field field = field_from_name(name);
+		if (field != Field::UNKNOWN && state.header_index[size_t(field)] == &value) index[size_t(field)] = &value;
+	}
+	for (auto &[name, value] : state.headers) {
+		Field field = field_from_name(name);
+		if (field != Field::UNKNOWN && !index[size_t(field)]) index[size_t(field)] = &value;
+	}
+	state.header_index = index;
+	state.header_index_stale = false;
+}
+
+const std::string *
+Request::header(Field field) const
+{
+	if (m->header_index_stale) reindex_headers(*m);
+	return m->header_index[size_t(field)];
+}
+
+void
+Request::add_header(std::string_view name, std::string value)
+{
+	auto it = m->headers.emplace(name, std::move(value));
+	Field field = field_from_name(name);
+	if (field != Field::UNKNOWN && !m->header_index[size_t(field)]) m->header_index[size_t(field)] = &it->second;
+}
+
+void
+Request::set_header(std::string_view name, std::string value)
+{
+	auto [first, last] = m->headers.equal_range(name);
+	m->headers.erase(first, last);
+	auto it = m->headers.emplace(name, std::move(value));
+	Field field = field_from_name(name);
+	if (field != Field::UNKNOWN) m->header_index[size_t(field)] = &it->second;
+}
+
+void
+Request::remove_header(std::string_view name)
+{
+	auto [first, last] = m->headers.equal_range(name);
+	m->headers.erase(first, last);
+	Field field = field_from_name(name);
+	if (field != Field::UNKNOWN) m->header_index[size_t(field)] = nullptr;
+}
+
 MiddlewareI &
 Request::do_middleware(size_t hash) const
 {
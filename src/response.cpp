@@ -38,4 +38,34 @@ Response::headers() const
 	return m->response_headers;
 }
 
+const std::string *
+Response::header(Field field) const
+{
+	if (m->response_fields_set[size_t(field)]) {
+		return &m->response_fields[size_t(field)];
+	}
+	if (field == Field::UNKNOWN || m->response_headers.empty()) return nullptr;
+	auto it = m->response_headers.find(field_name(field));
+	return it != m->response_headers.end() ? &it->second : nullptr;
+}
+
+void
+Response::header(Field field, std::string value)
+{
+	if (field == Field::UNKNOWN) return;
+	if (!m->response_headers.empty()) {
+		auto [first, last] = m->response_headers.equal_range(field_name(field));
+		m->response_headers.erase(first, last);
+	}
+	m->response_fields[size_t(field)] = std::move(value);
+	m->response_fields_set[size_t(field)] = true;
+}
+
+JsonWriter
+Response::json_writer()
+{
+	header(Field::CONTENT_TYPE, "application/json");
+	return JsonWriter(m->response_body_stream);
+}
+
 }
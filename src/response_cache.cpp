@@ -0,0 +1,206 @@
+#include "internal.hpp"
+#include <algorithm>
+
+namespace woof {
+
+// Roughly what an entry costs besides its key and bytes: the list node, the map node and bucket,
+// and the shared_ptr control block
+static constexpr size_t ENTRY_OVERHEAD = 160;
+
+ResponseCacheState::ResponseCacheState(size_t max_bytes, size_t nshards_)
+:
+	shard_max_bytes(max_bytes / std::max<size_t>(nshards_, 1)),
+	nshards(std::max<size_t>(nshards_, 1)),
+	shards(new Shard[nshards])
+{}
+
+std::shared_ptr<const PreparedResponse>
+ResponseCacheState::find(std::string_view key)
+{
+	Shard &s = shard(key);
+	{
+		std::lock_guard lock(s.mutex);
+		auto it = s.map.find(key);
+		if (it != s.map.end()) {
+			auto entry = it->second;
+			if (entry->expires > std::chrono::steady_clock::now()) {
+				s.lru.splice(s.lru.begin(), s.lru, entry);
+				hits.fetch_add(1, std::memory_order_relaxed);
+				return entry->response;
+			}
+			s.bytes -= entry->size;
+			s.map.erase(it);
+			s.lru.erase(entry);
+		}
+	}
+	misses.fetch_add(1, std::memory_order_relaxed);
+	return {};
+}
+
+void
+ResponseCacheState::store(std::string key, std::shared_ptr<const PreparedResponse> response, std::chrono::seconds ttl)
+{
+	size_t size = key.size() + response->head.size() + response->tail.size() + ENTRY_OVERHEAD;
+	if (size > shard_max_bytes) return;
+	auto expires = std::chrono::steady_clock::now() + ttl;
+	
+	Shard &s = shard(key);
+	std::lock_guard lock(s.mutex);
+	auto it = s.map.find(key);
+	if (it != s.map.end()) {
+		auto entry = it->second;
+		s.bytes -= entry->size;
+		s.map.erase(it);
+		s.lru.erase(entry);
+	}
+	while (s.bytes + size > shard_max_bytes) {
+		Entry &victim = s.lru.back();
+		s.bytes -= victim.size;
+		s.map.erase(victim.key);
+		s.lru.pop_back();
+	}
+	s.lru.push_front({std::move(key), std::move(response), expires, size});
+	s.map.emplace(s.lru.front().key, s.lru.begin());
+	s.bytes += size;
+}
+
+static bool
+is_cacheable_status(int status)
+{
+	switch (status) {
+	case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 405: case 410: case 414: case 501:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static std::string_view
+trim(std::string_view s)
+{
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+	return s;
+}
+
+static bool
+iequals(std::string_view a, std::string_view b)
+{
+	return CaseInsensitiveEquals()(a, b);
+}
+
+// Calls f(name, value) for each directive of a Cache-Control value
+template<class F>
+static void
+for_each_directive(std::string_view cache_control, F f)
+{
+	while (!cache_control.empty()) {
+		size_t comma = cache_control.find(',');
+		std::string_view directive = trim(cache_control.substr(0, comma));
+		cache_control = comma == std::string_view::npos ? std::string_view() : cache_control.substr(comma + 1);
+		
+		size_t eq = directive.find('=');
+		std::string_view name = trim(directive.substr(0, eq));
+		std::string_view value = eq == std::string_view::npos ? std::string_view() : trim(directive.substr(eq + 1));
+		f(name, value);
+	}
+}
+
+std::chrono::seconds
+ResponseCacheState::ttl(int status, std::string_view cache_control, bool set_cookie, std::string_view vary, bool authorization) const
+{
+	if (!is_cacheable_status(status) || set_cookie || trim(vary) == "*") return std::chrono::seconds(0);
+	std::optional<long> max_age, s_maxage;
+	bool uncacheable = false, shared = false;
+	for_each_directive(cache_control, [&](std::string_view name, std::string_view value) {
+		if (iequals(name, "no-store") || iequals(name, "no-cache") || iequals(name, "private")) uncacheable = true;
+		if (iequals(name, "public") || iequals(name, "must-revalidate")) shared = true;
+		long seconds;
+		if (iequals(name, "max-age") && StringConverter<long>::convert(seconds, value)) max_age = seconds;
+		if (iequals(name, "s-maxage") && StringConverter<long>::convert(seconds, value)) s_maxage = seconds;
+	});
+	// RFC 9111 3.5: what's sent to a client with credentials is only shared if it says so
+	if (uncacheable || (authorization && !shared && !s_maxage)) return std::chrono::seconds(0);
+	if (s_maxage) return std::chrono::seconds(*s_maxage);
+	if (max_age) return std::chrono::seconds(*max_age);
+	return default_ttl;
+}
+
+void
+ResponseCacheState::request_directives(std::string_view cache_control, bool &serve, bool &store)
+{
+	serve = store = true;
+	for_each_directive(cache_control, [&](std::string_view name, std::string_view) {
+		if (iequals(name, "no-cache")) serve = false;
+		if (iequals(name, "no-store")) serve = store = false;
+	});
+}
+
+ResponseCache::ResponseCache(size_t max_bytes, size_t nshards)
+:
+	m(std::make_shared<ResponseCacheState>(max_bytes, nshards))
+{}
+
+ResponseCache &
+ResponseCache::vary(const std::string &header)
+{
+	m->vary.push_back(header);
+	return *this;
+}
+
+ResponseCache &
+ResponseCache::default_ttl(std::chrono::seconds ttl)
+{
+	m->default_ttl = ttl;
+	return *this;
+}
+
+void
+ResponseCache::clear() const
+{
+	for (size_t i = 0; i < m->nshards; ++i) {
+		auto &s = m->shards[i];
+		std::lock_guard lock(s.mutex);
+		s.map.clear();
+		s.lru.clear();
+		s.bytes = 0;
+	}
+}
+
+size_t
+ResponseCache::size() const
+{
+	size_t n = 0;
+	for (size_t i = 0; i < m->nshards; ++i) {
+		auto &s = m->shards[i];
+		std::lock_guard lock(s.mutex);
+		n += s.lru.size();
+	}
+	return n;
+}
+
+size_t
+ResponseCache::bytes() const
+{
+	size_t n = 0;
+	for (size_t i = 0; i < m->nshards; ++i) {
+		auto &s = m->shards[i];
+		std::lock_guard lock(s.mutex);
+		n += s.bytes;
+	}
+	return n;
+}
+
+uint64_t
+ResponseCache::hits() const
+{
+	return m->hits.load(std::memory_order_relaxed);
+}
+
+uint64_t
+ResponseCache::misses() const
+{
+	return m->misses.load(std::memory_order_relaxed);
+}
+
+}
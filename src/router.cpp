@@ -0,0 +1,159 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace woof {
+
+std::shared_ptr<RouterNode>
+resolve_pattern(std::shared_ptr<ServerState> m, const PathPattern &path, std::vector<PathParam> &path_param_names)
+{
+	std::shared_ptr<RouterNode> node = m->router;
+	for (int i = 0; auto &segment : path.segments) {
+		if (segment.wildcard) {
+			if (!segment.name.empty() || segment.type != ParamType::STRING) {
+				path_param_names.emplace_back(i, segment.name, segment.type);
+			}
+			if (!node->wildcard) {
+				node->wildcard = std::make_shared<RouterNode>(node);
+			}
+			node = node->wildcard;
+		} else {
+			if (!node->subpaths.contains(segment.name)) {
+				node->subpaths[segment.name] = std::make_shared<RouterNode>(node);
+			}
+			node = node->subpaths[segment.name];
+		}
+		++i;
+	}
+	return node;
+}
+
+template<class T>
+static inline bool
+convert_as(std::string_view s, T &x)
+{
+	return StringConverter<T>::convert(x, s);
+}
+
+bool
+convert_params(const std::vector<PathParam> &params, const std::vector<std::string> &path_segments, std::vector<ParamValue> *values)
+{
+	if (values) values->resize(params.size());
+	for (size_t i = 0; i < params.size(); ++i) {
+		const std::string &s = path_segments[params[i].segment];
+		ParamValue v {};
+		bool ok = true;
+		switch (params[i].type) {
+		case ParamType::STRING: break;
+		case ParamType::INT: { int x;      ok = convert_as(s, x); v.i = x; } break;
+		case ParamType::I32: { int32_t x;  ok = convert_as(s, x); v.i = x; } break;
+		case ParamType::I64: { int64_t x;  ok = convert_as(s, x); v.i = x; } break;
+		case ParamType::U32: { uint32_t x; ok = convert_as(s, x); v.u = x; } break;
+		case ParamType::U64: { uint64_t x; ok = convert_as(s, x); v.u = x; } break;
+		case ParamType::F32: { float x;    ok = convert_as(s, x); v.f = x; } break;
+		case ParamType::F64: { double x;   ok = convert_as(s, x); v.f = x; } break;
+		}
+		if (!ok) return false;
+		if (values) (*values)[i] = v;
+	}
+	return true;
+}
+
+// Depth-first, so that literal segments take priority over wildcards. A route whose typed params
+// don't convert doesn't match, and the search goes on to the next candidate.
+std::shared_ptr<RouterNode>
+dfs_route(RouteMatch &match, Method method, std::shared_ptr<RouterNode> node, const std::vector<std::string> &path_segments, size_t idx)
+{
+	if (idx == path_segments.size()) {
+		auto it = node->handlers.find(method);
+		if (it == node->handlers.end()) {
+			for (auto &[other, handler] : node->handlers) match.allowed |= 1 << int(other);
+			return {};
+		}
+		if (!convert_params(it->second.path_params, path_segments, &match.param_values)) {
+			match.rejected = true;
+			return {};
+		}
+		return node;
+	}
+	for (auto &subpath : node->subpaths) {
+		if (subpath.first == path_segments[idx]) {
+			auto sp = dfs_route(match, method, subpath.second, path_segments, idx + 1);
+			if (sp) return sp;
+		}
+	}
+	if (node->wildcard) {
+		auto sp = dfs_route(match, method, node->wildcard, path_segments, idx + 1);
+		if (sp) return sp;
+	}
+	auto it = node->globstar_handlers.find(method);
+	if (it != node->globstar_handlers.end()) {
+		if (!convert_params(it->second.path_params, path_segments, &match.param_values)) {
+			match.rejected = true;
+			return {};
+		}
+		match.globstar = true;
+		return node;
+	}
+	for (auto &[other, handler] : node->globstar_handlers) match.allowed |= 1 << int(other);
+	return {};
+}
+
+// Only the literal segments, typed params are checked separately
+bool
+match_pattern(const PathPattern &path, const std::vector<std::string> &path_segments)
+{
+	const size_t nreal = path_segments.size();
+	const size_t nsegments = path.segments.size();
+	if (nreal < nsegments) return false;
+	for (size_t i = 0; i < nsegments; ++i) {
+		auto &segment = path.segments[i];
+		if (!segment.wildcard && path_segments[i] != segment.name) {
+			return false;
+		}
+	}
+	return path.suffix_wildcard || nreal == nsegments;
+}
+
+void
+resolve_middlewares(ServerState &m, const std::vector<std::string> &path_segments, std::vector<std::pair<size_t, ServerState::MiddlewareConfig *>> &mw_list)
+{
+	const int nreal = path_segments.size();
+	for (size_t hash : m.mw_list) {
+		auto &mwc = m.mw_map[hash];
+		if (match_pattern(mwc.path, path_segments) && convert_params(mwc.path_params, path_segments, nullptr)) {
+			mw_list.emplace_back(hash, &mwc);
+		}
+	}
+	std::sort(mw_list.begin(), mw_list.end(), [&m, nreal](const auto &a, const auto &b) {
+		ServerState::MiddlewareConfig &ac = m.mw_map[a.first];
+		ServerState::MiddlewareConfig &bc = m.mw_map[b.first];
+		int asz = ac.path.segments.size();
+		int bsz = bc.path.segments.size();
+		if ((asz == nreal) > (bsz == nreal)) return true;
+		if ((asz == nreal) < (bsz == nreal)) return false;
+		if (asz < bsz) return true;
+		if (asz > bsz) return false;
+		return ac.idx < bc.idx;
+	});
+}
+
+/*static inline void
+list_middlewares(std::shared_ptr<RouterNode> node, std::vector<RouterNode::MiddlewareHandler *> &mw_list)
+{
+	for (auto it = node->mw_list.rbegin(); it != node->mw_list.rend(); ++it) {
+		if (!it->globstar) {
+			mw_list.push_back(&*it);
+		}
+	}
+	for (auto nd = node; nd; nd = nd->parent.lock()) {
+		for (auto it = nd->mw_list.rbegin(); it != nd->mw_list.rend(); ++it) {
+			if (it->globstar) {
+				mw_list.push_back(&*it);
+			}
+		}
+	}
+	std::reverse(mw_list.begin(), mw_list.end());
+}*/
+
+}
@@ -33,32 +33,31 @@ Server::port(int port)
 	return *this;
 }
 
-static inline std::shared_ptr<RouterNode>
-resolve_pattern(std::shared_ptr<ServerState> m, const PathPattern &path, std::vector<std::pair<int, std::string>> &path_param_names)
+Server &
+Server::listen(const std::string &address, int port)
 {
-	std::shared_ptr<RouterNode> node = m->router;
-	for (int i = 0; auto &segment : path.segments) {
-		if (segment.wildcard) {
-			if (!segment.name.empty()) path_param_names.emplace_back(i, segment.name);
-			if (!node->wildcard) {
-				node->wildcard = std::make_shared<RouterNode>(node);
-			}
-			node = node->wildcard;
-		} else {
-			if (!node->subpaths.contains(segment.name)) {
-				node->subpaths[segment.name] = std::make_shared<RouterNode>(node);
-			}
-			node = node->subpaths[segment.name];
-		}
-		++i;
-	}
-	return node;
+	m->listeners.push_back({address, port, 0});
+	return *this;
 }
 
-void
-Server::add_endpoint(Method method, const PathPattern &path, const RequestHandler &handler)
+Server &
+Server::listen_unix(const std::string &path, unsigned permissions)
 {
-	std::vector<std::pair<int, std::string>> path_param_names;
+	m->listeners.push_back({path, -1, permissions});
+	return *this;
+}
+
+Server &
+Server::queue_deadline(std::chrono::milliseconds deadline)
+{
+	m->queue_deadline = deadline;
+	return *this;
+}
+
+RouterNode::Handler &
+add_handler(std::shared_ptr<ServerState> m, Method method, const PathPattern &path)
+{
+	std::vector<PathParam> path_param_names;
 	std::shared_ptr<RouterNode> node = resolve_pattern(m, path, path_param_names);
 	//std::vector<std::string> path_param_names;
 	//size_t segment_start = path[0] == '/';
@@ -88,17 +87,42 @@ Server::add_endpoint(Method method, const PathPattern &path, const RequestHandle
 		// TODO: error on endpoint redefinition
 	}
 	path_param_names.shrink_to_fit();
-	map[method] = {std::move(path_param_names), handler};
+	auto &handler = map[method] = RouterNode::Handler();
+	handler.path_params = std::move(path_param_names);
+	return handler;
+}
+
+void
+Server::add_endpoint(Method method, const PathPattern &path, const RequestHandler &handler)
+{
+	add_handler(m, method, path).handler = handler;
+}
+
+void
+Server::access_log(const AsyncLogger &logger, const PathPattern &path)
+{
+	if (m->access_log) {
+		m->warn("There's already an access log, the new one is ignored");
+		return;
+	}
+	m->access_log.emplace(path, logger);
+}
+
+void
+Server::cache(const ResponseCache &cache, const PathPattern &path)
+{
+	m->caches.emplace_back(path, cache.m);
 }
 
 void
 Server::do_add_middleware(size_t hash, const PathPattern &path, const MiddlewareCreator &mw)
 {
-	std::vector<std::pair<int, std::string>> path_param_names;
+	std::vector<PathParam> path_param_names;
 	for (int i = 0; auto &segment : path.segments) {
-		if (segment.wildcard && !segment.name.empty()) {
-			path_param_names.emplace_back(i, segment.name);
+		if (segment.wildcard && (!segment.name.empty() || segment.type != ParamType::STRING)) {
+			path_param_names.emplace_back(i, segment.name, segment.type);
 		}
+		++i;
 	}
 	m->mw_map[hash] = {mw, path, std::move(path_param_names), int(m->mw_list.size())};
 	m->mw_list.push_back(hash);
@@ -1,256 +1,138 @@
-#include "internal.hpp"
+#include "connection.hpp"
+#ifdef WOOF_TLS
+#include "tls.hpp"
+#endif
 #include <boost/asio.hpp>
-#include <boost/asio/experimental/concurrent_channel.hpp>
-#include <boost/beast.hpp>
 #include <algorithm>
+#include <deque>
 #include <future>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <list>
+#include <system_error>
+#include <sys/stat.h>
 
 namespace asio = boost::asio;
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
 using tcp = boost::asio::ip::tcp;
+using unix_socket = boost::asio::local::stream_protocol;
 using error_code = boost::system::error_code;
 
 namespace woof {
 
-inline constexpr Method
-http_method(http::verb verb)
-{
-	switch (verb) {
-		case http::verb::get:     return Method::GET;
-		case http::verb::head:    return Method::HEAD;
-		case http::verb::post:    return Method::POST;
-		case http::verb::put:     return Method::PUT;
-		case http::verb::delete_: return Method::DELETE;
-		case http::verb::connect: return Method::CONNECT;
-		case http::verb::options: return Method::OPTIONS;
-		case http::verb::trace:   return Method::TRACE;
-		case http::verb::patch:   return Method::PATCH;
-		default: return Method::UNKNOWN;
-	}
-}
-
-static inline std::shared_ptr<RouterNode>
-dfs_route(bool &globstar, Method method, std::shared_ptr<RouterNode> node, std::vector<std::string>::iterator it, std::vector<std::string>::iterator end)
-{
-	if (it == end) {
-		if (node->handlers.contains(method)) {
-			return node;
-		} else {
-			return {};
-		}
-	}
-	for (auto &subpath : node->subpaths) {
-		if (subpath.first == *it) {
-			auto sp = dfs_route(globstar, method, subpath.second, std::next(it), end);
-			if (sp) return sp;
-		}
-	}
-	if (node->wildcard) {
-		auto sp = dfs_route(globstar, method, node->wildcard, std::next(it), end);
-		if (sp) return sp;
-	}
-	if (node->globstar_handlers.contains(method)) {
-		globstar = true;
-		return node;
-	}
-	return {};
-}
-
-/*static inline void
-list_middlewares(std::shared_ptr<RouterNode> node, std::vector<RouterNode::MiddlewareHandler *> &mw_list)
-{
-	for (auto it = node->mw_list.rbegin(); it != node->mw_list.rend(); ++it) {
-		if (!it->globstar) {
-			mw_list.push_back(&*it);
-		}
-	}
-	for (auto nd = node; nd; nd = nd->parent.lock()) {
-		for (auto it = nd->mw_list.rbegin(); it != nd->mw_list.rend(); ++it) {
-			if (it->globstar) {
-				mw_list.push_back(&*it);
+// Accepts connections on one endpoint, with several accepts in flight so that a burst of connections
+// is taken in one go. Each listener's accepts run on its own strand, so listeners don't wait on each
+// other. Only a listener paused by the connection cap goes through the shared strand, which is where
+// `pending`, `stopped` and resume() are touched.
+template<class Protocol>
+struct Listener {
+	asio::io_context &ioc;
+	ConnectionRegistry &connections;
+	asio::strand<asio::io_context::executor_type> &shared;
+	asio::strand<asio::io_context::executor_type> strand;
+	typename Protocol::acceptor acceptor;
+	std::function<void(typename Protocol::socket)> dispatch;
+	// Connections accepted when there's no room wait here until one closes, and the accepts that got
+	// them stop. resume() is called once they're here, in case one closed in between.
+	std::deque<typename Protocol::socket> pending;
+	int stopped = 0;
+	// Accepts waiting out the backoff after running out of file descriptors or memory
+	asio::steady_timer backoff_timer;
+	int backing_off = 0;
+	
+	Listener(asio::io_context &ioc_, ConnectionRegistry &connections_, asio::strand<asio::io_context::executor_type> &shared_)
+	:
+		ioc(ioc_),
+		connections(connections_),
+		shared(shared_),
+		strand(asio::make_strand(ioc_)),
+		acceptor(strand),
+		backoff_timer(strand)
+	{}
+	
+	void
+	accept()
+	{
+		// The sockets get the io_context's executor, not the strand
+		acceptor.async_accept(ioc, [this](error_code ec, typename Protocol::socket socket) {
+			if (ec == asio::error::operation_aborted) return;
+			// Accepting again right away would spin until a descriptor or memory is freed
+			if (
+				ec == boost::system::errc::too_many_files_open ||
+				ec == boost::system::errc::too_many_files_open_in_system ||
+				ec == boost::system::errc::no_buffer_space ||
+				ec == boost::system::errc::not_enough_memory
+			) {
+				backoff();
+				return;
 			}
-		}
-	}
-	std::reverse(mw_list.begin(), mw_list.end());
-}*/
-
-static inline void
-handle_connection(std::shared_ptr<ServerState> m, std::shared_ptr<tcp::socket> socket)
-{ // TODO: general error handling here
-	beast::tcp_stream stream(std::move(*socket));
-	beast::flat_buffer buffer;
-	
-	auto state = std::make_shared<ConnectionState>();
-	state->status_code = 200;
-	
-	auto respond = [&stream](Status status) {
-		http::response<http::empty_body> beast_response;
-		beast_response.version(11);
-		beast_response.result(status);
-		beast_response.prepare_payload();
-		http::write(stream, beast_response);
-		stream.close();
-	};
-	
-	// 1. Request head
-	// TODO: request size limits
-	http::request_parser<http::empty_body> head_parser;
-	http::read_header(stream, buffer, head_parser);
-	auto &head = head_parser.get();
-	
-	// 1.1. Request method
-	state->method = http_method(head.method());
-	
-	// 1.2. Parse the target string
-	state->target_string_raw = head.target();
-	state->target = ParsedTarget(state->target_string_raw);
-	if (!state->target.success) {
-		// Invalid target string => 400
-		respond(400);
-		return;
-	}
-	state->path_string_raw = state->target.path_raw;
-	state->query_string_raw = state->target.query_raw;
-	// TODO: handling trailing slash quirks all around the library
-	if (state->target.path_segments.back().empty()) state->target.path_segments.pop_back();
-	
-	// 1.3. Route the request
-	bool globstar = false;
-	std::shared_ptr<RouterNode> node = dfs_route(
-		globstar,
-		state->method,
-		m->router,
-		state->target.path_segments.begin(),
-		state->target.path_segments.end()
-	);
-	if (!node) {
-		// Handler not found => 404
-		respond(404);
-		return;
-	}
-	const RouterNode::Handler &handler = (globstar ? node->globstar_handlers : node->handlers)[state->method];
-	
-	// 1.4. Resolve the list of middlewares in correct order
-	std::vector<std::pair<size_t, ServerState::MiddlewareConfig *>> mw_list;
-	const int nreal = state->target.path_segments.size();
-	for (size_t hash : m->mw_list) {
-		auto &mwc = m->mw_map[hash];
-		const int nsegments = mwc.path.segments.size();
-		if (nreal < nsegments) continue;
-		for (int i = 0; i < nsegments; ++i) {
-			auto &real_segment = state->target.path_segments[i];
-			auto &segment = mwc.path.segments[i];
-			if (!segment.wildcard && real_segment != segment.name) {
-				goto no_match;
+			if (!ec) {
+				if (!connections.make_room()) {
+					asio::post(shared, [this, socket = std::move(socket)]() mutable {
+						pending.push_back(std::move(socket));
+						++stopped;
+						resume();
+					});
+					return;
+				}
+				dispatch(std::move(socket));
 			}
-		}
-		if (mwc.path.suffix_wildcard || nreal == nsegments) {
-			mw_list.emplace_back(hash, &mwc);
-		}
-		no_match:;
-	}
-	std::sort(mw_list.begin(), mw_list.end(), [&m, nreal](const auto &a, const auto &b) {
-		ServerState::MiddlewareConfig &ac = m->mw_map[a.first];
-		ServerState::MiddlewareConfig &bc = m->mw_map[b.first];
-		int asz = ac.path.segments.size();
-		int bsz = bc.path.segments.size();
-		if ((asz == nreal) > (bsz == nreal)) return true;
-		if ((asz == nreal) < (bsz == nreal)) return false;
-		if (asz < bsz) return true;
-		if (asz > bsz) return false;
-		return ac.idx < bc.idx;
-	});
-	
-	// 1.5. Path params
-	std::unordered_map<std::string, std::string> endpoint_path_params;
-	for (auto &p : handler.path_params) {
-		endpoint_path_params[p.second] = state->target.path_segments[p.first];
+			accept();
+		});
 	}
 	
-	// 1.6. Query params
-	for (auto &p : state->target.query_params) {
-		state->query_params.emplace(std::move(p.first), std::move(p.second));
-	}
-	
-	// 1.7. Request headers
-	for (auto &field : head) {
-		state->headers.emplace(field.name_string(), field.value());
+	void
+	backoff()
+	{
+		if (backing_off++ > 0) return;
+		backoff_timer.expires_after(std::chrono::milliseconds(100));
+		backoff_timer.async_wait([this](error_code ec) {
+			if (ec) return;
+			for (; backing_off > 0; --backing_off) accept();
+		});
 	}
 	
-	// 2. Request body
-	
-	http::request_parser<http::string_body> parser(std::move(head_parser));
-	http::read(stream, buffer, parser);
-	auto full_request = parser.release();
-	
-	state->request_body_stream = std::stringstream(std::move(full_request.body()));
-	
-	// 3. Call the handler
-	
-	Request request(state);
-	Response response(state);
-	
-	// 3.1. Instantiate the middlewares and assemble their path param maps
-	std::vector<std::pair<MiddlewareI *, std::unordered_map<std::string, std::string>>> mws;
-	mws.reserve(mw_list.size());
-	for (auto &[hash, mwc] : mw_list) {
-		std::unordered_map<std::string, std::string> path_params;
-		for (auto &p : mwc->path_params) {
-			path_params[p.second] = state->target.path_segments[p.first];
+	void
+	resume()
+	{
+		while (!pending.empty() && connections.make_room()) {
+			dispatch(std::move(pending.front()));
+			pending.pop_front();
 		}
-		MiddlewareI *mw = mwc->creator();
-		state->mw_map[hash] = mw;
-		mws.emplace_back(mw, std::move(path_params));
-	}
-	
-	// 3.2. Call MiddlewareI::before on middlewares
-	for (auto &mw : mws) {
-		state->path_params = std::move(mw.second);
-		mw.first->before(request, response);
-		mw.second = std::move(state->path_params);
-	}
-	
-	// 3.3. Call the endpoint handler
-	try {
-		state->path_params = std::move(endpoint_path_params);
-		handler.handler(request, response);
-	} catch (...) {
-		// TODO: handle endpoint handler exception
-	}
-	
-	// 3.4. Call MiddlewareI::after on middlewares
-	for (auto it = mws.rbegin(); it != mws.rend(); ++it) {
-		state->path_params = std::move(it->second);
-		it->first->after(request, response);
-	}
-	
-	// 3.5. Delete middlewares
-	for (auto [hash, mw] : state->mw_map) {
-		delete mw;
-	}
-	
-	// 4. Write the response
-	
-	http::response<http::string_body> beast_response;
-	beast_response.version(11);
-	beast_response.result(state->status_code);
-	// TODO: setting content-type design decisions, etc
-	beast_response.insert("Content-Type", "text/plain; charset=utf-8");
-	beast_response.body() = std::move(state->response_body_stream).str();
-	
-	for (auto &[name, value] : state->response_headers) {
-		beast_response.insert(name, value);
+		if (!pending.empty() || stopped == 0) return;
+		asio::post(strand, [this, n = std::exchange(stopped, 0)] {
+			for (int i = 0; i < n; ++i) accept();
+		});
 	}
-	
-	beast_response.prepare_payload();
-	
-	http::write(stream, beast_response);
-	stream.close();
-}
+};
+
+// Owns an accepted connection until handle_connection is done with it, or hands the stream over to
+// something that runs asynchronously, along with the slot
+template<class Stream>
+struct Connection {
+	std::shared_ptr<ConnectionSlot> slot;
+	std::chrono::steady_clock::time_point accepted = std::chrono::steady_clock::now();
+	Stream stream;
+	
+	template<class Socket>
+	Connection(ConnectionRegistry &connections, Socket &&socket)
+	:
+		slot(std::make_shared<ConnectionSlot>(connections, socket.native_handle())),
+		stream(std::move(socket))
+	{}
+	
+#ifdef WOOF_TLS
+	Connection(ConnectionRegistry &connections, tcp::socket &&socket, asio::ssl::context &context)
+	:
+		slot(std::make_shared<ConnectionSlot>(connections, socket.native_handle())),
+		stream(beast::tcp_stream(std::move(socket)), context)
+	{}
+#endif
+	
+	// Unless it went with the stream, the slot is released before the socket's closed, e.g. when the
+	// client never sent anything or the TLS handshake failed
+	~Connection() { slot.reset(); }
+};
 
 void
 Server::run(int nworkers)
@@ -263,11 +145,52 @@ Server::run(int nworkers)
 		ioc.stop();
 	});
 	
-	tcp::acceptor acceptor(ioc);
-	tcp::endpoint endpoint(asio::ip::make_address(m->address), m->port);
-	acceptor.open(endpoint.protocol());
-	acceptor.bind(endpoint);
-	acceptor.listen();
+	// Listeners are opened before anything else, so that errors are thrown from here
+	auto shared_strand = asio::make_strand(ioc);
+	std::list<Listener<tcp>> tcp_listeners;
+	std::list<Listener<unix_socket>> unix_listeners;
+	std::string endpoints;
+	auto listeners = m->listeners;
+	if (listeners.empty()) listeners.push_back({m->address, m->port, 0});
+	int backlog = m->socket_options.backlog > 0 ? m->socket_options.backlog : int(asio::socket_base::max_listen_connections);
+	for (auto &config : listeners) {
+		if (!endpoints.empty()) endpoints.append(", ");
+		if (config.port == -1) {
+			// Only a stale socket file is removed, not whatever else might be there by mistake
+			struct stat st;
+			if (::stat(config.address.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+				::unlink(config.address.c_str());
+			}
+			auto &listener = unix_listeners.emplace_back(ioc, m->connections, shared_strand);
+			unix_socket::endpoint endpoint(config.address);
+			listener.acceptor.open(endpoint.protocol());
+			apply_listener_options(*m, listener.acceptor.native_handle(), false);
+			// The socket file is created owner-only, so nobody else can connect before the chmod. The
+			// umask is process-wide, so it's only changed around the bind.
+			mode_t umask = ::umask(0177);
+			error_code ec;
+			listener.acceptor.bind(endpoint, ec);
+			::umask(umask);
+			if (ec) throw boost::system::system_error(ec, "bind");
+			if (::chmod(config.address.c_str(), config.permissions) != 0) {
+				std::error_code chmod_ec(errno, std::generic_category());
+				m->error("Couldn't set the permissions of " + config.address + ": " + chmod_ec.message());
+				throw std::system_error(chmod_ec, "chmod " + config.address);
+			}
+			listener.acceptor.listen(backlog);
+			endpoints.append("unix:").append(config.address);
+		} else {
+			auto &listener = tcp_listeners.emplace_back(ioc, m->connections, shared_strand);
+			tcp::endpoint endpoint(asio::ip::make_address(config.address), config.port);
+			listener.acceptor.open(endpoint.protocol());
+			apply_listener_options(*m, listener.acceptor.native_handle(), true);
+			listener.acceptor.bind(endpoint);
+			listener.acceptor.listen(backlog);
+			std::string address = endpoint.address().to_string();
+			if (endpoint.address().is_v6()) address = "[" + address + "]";
+			endpoints.append(address).append(":").append(std::to_string(endpoint.port()));
+		}
+	}
 	
 	/*
 	auto handler_lambda = [](std::shared_ptr<tcp::socket> socket) {
@@ -441,49 +364,112 @@ Server::run(int nworkers)
 	}; // handler_lambda
 	*/
 	
-	// It needs to take error_code ~~in order for the use_future completion token to work~~
-	// It just fucking doesn't compile without it, thanks for not telling me in the documentation
-	asio::experimental::concurrent_channel<void(error_code, std::shared_ptr<tcp::socket>)> jobs(ioc, 3*nworkers);
-	
-	std::function<void(error_code, std::shared_ptr<tcp::socket>)> worker_fn =
-		[this, &jobs, &worker_fn](error_code, std::shared_ptr<tcp::socket> sp) {
-			handle_connection(m, sp);
-			jobs.async_receive(worker_fn);
-		};
+	// Connections go straight to the io_context, and are handled by whichever thread picks them up
+	auto serve = [this](auto connection) {
+		try {
+			handle_connection(m, connection->stream, connection->accepted, connection->slot);
+		} catch (const boost::system::system_error &e) {
+			// The client went away, sent garbage, or the connection was evicted
+			m->debug(std::string("Connection error: ") + e.what());
+		}
+	};
 	
+	auto cpus = plan_worker_cpus(*m, nworkers);
 	std::vector<std::thread> workers(nworkers);
 	for (int i = 0; i < nworkers; ++i) {
 		workers[i] = std::thread(
-			[this, &ioc, &jobs, &worker_fn, i]() {
-				jobs.async_receive(worker_fn);
+			[this, &ioc, &cpus, i]() {
+				if (!cpus.empty()) pin_thread(*m, cpus[i]);
 				ioc.run();
 				m->info("Worker " + std::to_string(i) + " stopped");
 			}
 		);
 	}
 	
-	std::function<void(error_code, tcp::socket)> accept_fn =
-		[this, &ioc, &acceptor, &jobs, &accept_fn](error_code, tcp::socket socket) {
-			jobs.try_send(error_code(), std::make_shared<tcp::socket>(std::move(socket)));
-			acceptor.async_accept(ioc, accept_fn);
-		};
-	
-	acceptor.async_accept(ioc, accept_fn);
+	// With TLS, the connection is handled once the handshake is done. Until then it only takes up a
+	// connection slot.
+	auto dispatch = [this, &ioc, serve](auto socket) {
+		if constexpr (std::is_same_v<decltype(socket), unix_socket::socket>) {
+			auto connection = std::make_unique<Connection<beast::basic_stream<unix_socket>>>(m->connections, std::move(socket));
+			asio::post(ioc, [serve, connection = std::move(connection)]() mutable { serve(std::move(connection)); });
+		} else {
+			apply_connection_options(*m, socket.native_handle());
+#ifdef WOOF_TLS
+			if (m->tls) {
+				auto connection = std::make_unique<Connection<TlsStream>>(m->connections, std::move(socket), m->tls->context);
+				auto &stream = connection->stream;
+				beast::get_lowest_layer(stream).expires_after(m->tls->config.handshake_timeout);
+				stream.async_handshake(asio::ssl::stream_base::server,
+					[this, serve, connection = std::move(connection)](error_code ec) mutable {
+						if (ec) {
+							m->debug("TLS handshake failed: " + ec.message());
+							return;
+						}
+						beast::get_lowest_layer(connection->stream).expires_never();
+						serve(std::move(connection));
+					}
+				);
+				return;
+			}
+#endif
+			auto connection = std::make_unique<Connection<beast::tcp_stream>>(m->connections, std::move(socket));
+			asio::post(ioc, [serve, connection = std::move(connection)]() mutable { serve(std::move(connection)); });
+		}
+	};
 	
+	auto resume_all = [&tcp_listeners, &unix_listeners] {
+		for (auto &listener : tcp_listeners) listener.resume();
+		for (auto &listener : unix_listeners) listener.resume();
+	};
 	{
-		char startup_message[200];
-		std::string address_string = endpoint.address().to_string();
-		snprintf(startup_message, sizeof(startup_message),
-			"Started Woof %s HTTP server at %s:%d on %d worker threads",
-			VERSION, address_string.c_str(), int(endpoint.port()), nworkers
-		);
-		m->info(startup_message);
+		std::lock_guard lock(m->connections.mutex);
+		m->connections.resume = [&shared_strand, &resume_all] {
+			asio::post(shared_strand, resume_all);
+		};
+	}
+	int accepts = std::max(nworkers, 1);
+	auto start = [&dispatch, accepts](auto &listener) {
+		listener.dispatch = dispatch;
+		asio::post(listener.strand, [&listener, accepts] {
+			for (int i = 0; i < accepts; ++i) listener.accept();
+		});
+	};
+	for (auto &listener : tcp_listeners) start(listener);
+	for (auto &listener : unix_listeners) start(listener);
+	
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+	const char *backend = "io_uring";
+#else
+	const char *backend = "epoll";
+#endif
+	m->info(std::string("Started Woof ") + VERSION + (m->tls ? " HTTPS" : " HTTP") + " server at " + endpoints
+		+ " on " + std::to_string(nworkers) + " worker threads, using " + backend);
+	if (!cpus.empty()) {
+		std::string placement;
+		for (int i = 0; i < nworkers; ++i) {
+			if (i > 0) placement.append(", ");
+			placement.append(std::to_string(i)).append(" on CPU ").append(std::to_string(cpus[i].cpu))
+				.append(" (node ").append(std::to_string(cpus[i].node)).append(")");
+		}
+		m->info("Workers " + placement);
 	}
 	
-	ioc.run();
+	// Pinned, only the workers run handlers, and the main thread waits for them
+	if (cpus.empty()) {
+		ioc.run();
+	} else {
+		for (std::thread &worker : workers) worker.join();
+	}
+	{
+		std::lock_guard lock(m->connections.mutex);
+		m->connections.resume = nullptr;
+	}
+	for (auto &listener : unix_listeners) {
+		::unlink(listener.acceptor.local_endpoint().path().c_str());
+	}
 	m->info("Main server thread finished work");
 	for (std::thread &worker : workers) {
-		worker.join();
+		if (worker.joinable()) worker.join();
 	}
 }
 
@@ -0,0 +1,61 @@
+#include "internal.hpp"
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace woof {
+
+static void
+set_option(const ServerState &m, int fd, int level, int name, int value, const char *what)
+{
+	if (::setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+		m.warn(std::string("Couldn't set ") + what + ": " + strerror(errno));
+	}
+}
+
+Server &
+Server::socket_options(const SocketOptions &options)
+{
+	m->socket_options = options;
+	return *this;
+}
+
+// Receive buffers are set before listen(), so that accepted connections inherit them in time for
+// the window scale to be negotiated
+void
+apply_listener_options(const ServerState &m, int fd, bool tcp)
+{
+	const SocketOptions &o = m.socket_options;
+	if (!tcp) return;
+	if (o.reuse_address) set_option(m, fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+	if (o.receive_buffer > 0) set_option(m, fd, SOL_SOCKET, SO_RCVBUF, o.receive_buffer, "SO_RCVBUF");
+#ifdef TCP_DEFER_ACCEPT
+	if (o.defer_accept > 0) set_option(m, fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, o.defer_accept, "TCP_DEFER_ACCEPT");
+#else
+	if (o.defer_accept > 0) m.warn("TCP_DEFER_ACCEPT isn't supported");
+#endif
+#ifdef TCP_FASTOPEN
+	if (o.fastopen > 0) set_option(m, fd, IPPROTO_TCP, TCP_FASTOPEN, o.fastopen, "TCP_FASTOPEN");
+#else
+	if (o.fastopen > 0) m.warn("TCP_FASTOPEN isn't supported");
+#endif
+}
+
+void
+apply_connection_options(const ServerState &m, int fd)
+{
+	const SocketOptions &o = m.socket_options;
+	if (o.no_delay) set_option(m, fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	if (o.send_buffer > 0) set_option(m, fd, SOL_SOCKET, SO_SNDBUF, o.send_buffer, "SO_SNDBUF");
+	if (o.keepalive) {
+		set_option(m, fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#ifdef TCP_KEEPIDLE
+		if (o.keepalive_idle > 0) set_option(m, fd, IPPROTO_TCP, TCP_KEEPIDLE, o.keepalive_idle, "TCP_KEEPIDLE");
+		if (o.keepalive_interval > 0) set_option(m, fd, IPPROTO_TCP, TCP_KEEPINTVL, o.keepalive_interval, "TCP_KEEPINTVL");
+		if (o.keepalive_count > 0) set_option(m, fd, IPPROTO_TCP, TCP_KEEPCNT, o.keepalive_count, "TCP_KEEPCNT");
+#endif
+	}
+}
+
+}
@@ -0,0 +1,61 @@
+#include <woof/woof.hpp>
+#include <bit>
+#include <cstring>
+
+namespace woof {
+
+// Runs of 8 digits are converted at once with SWAR, the leftover leading digits one by one. Up to 19
+// digits can't overflow a uint64_t, so only a 20th digit needs checking.
+
+static inline bool
+all_digits(uint64_t x) noexcept
+{
+	return (x & 0xf0f0f0f0f0f0f0f0) == 0x3030303030303030
+		&& ((x + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) == 0x3030303030303030;
+}
+
+// The first digit is in the lowest byte
+static inline uint64_t
+parse_eight_digits(uint64_t x) noexcept
+{
+	x = ((x & 0x0f0f0f0f0f0f0f0f) * 2561) >> 8;
+	x = ((x & 0x00ff00ff00ff00ff) * 6553601) >> 16;
+	return ((x & 0x0000ffff0000ffff) * 42949672960001) >> 32;
+}
+
+bool
+parse_decimal(std::string_view s, uint64_t &x) noexcept
+{
+	if (s.size() > 20) {
+		size_t start = s.find_first_not_of('0');
+		s.remove_prefix(start == std::string_view::npos ? s.size() - 1 : start);
+		if (s.size() > 20) return false;
+	}
+	const char *p = s.data();
+	size_t n = s.size();
+	if (n == 0) return false;
+	
+	size_t nfast = std::min<size_t>(n, 19);
+	size_t head = std::endian::native == std::endian::little ? nfast % 8 : nfast;
+	uint64_t v = 0;
+	for (size_t i = 0; i < head; ++i) {
+		unsigned d = uint8_t(p[i]) - '0';
+		if (d > 9) return false;
+		v = v * 10 + d;
+	}
+	for (size_t i = head; i < nfast; i += 8) {
+		uint64_t x;
+		memcpy(&x, p + i, 8);
+		if (!all_digits(x)) return false;
+		v = v * 100000000 + parse_eight_digits(x);
+	}
+	if (n == 20) {
+		unsigned d = uint8_t(p[19]) - '0';
+		if (d > 9 || v > (UINT64_MAX - d) / 10) return false;
+		v = v * 10 + d;
+	}
+	x = v;
+	return true;
+}
+
+}
@@ -0,0 +1,170 @@
+#include "internal.hpp"
+
+#ifdef WOOF_TLS
+
+#include "tls.hpp"
+#include <boost/asio/ssl/impl/src.hpp>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+namespace woof {
+
+// Where the SSL_CTX keeps its TlsState. Asio has the app data for itself.
+static int
+tls_state_index()
+{
+	static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+	return index;
+}
+
+static void
+new_ticket_key(TlsState::TicketKey &key)
+{
+	RAND_bytes(key.name, sizeof(key.name));
+	RAND_bytes(key.aes_key, sizeof(key.aes_key));
+	RAND_bytes(key.hmac_key, sizeof(key.hmac_key));
+	key.created = std::chrono::steady_clock::now();
+}
+
+// Encrypts new tickets with the current key, and decrypts ones made with either key, as documented
+// in SSL_CTX_set_tlsext_ticket_key_evp_cb(3)
+static int
+ticket_key_callback(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, int encrypt)
+{
+	auto tls = static_cast<TlsState *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), tls_state_index()));
+	TlsState::TicketKey key;
+	int result = 1;
+	if (encrypt) {
+		key = tls->current_ticket_key();
+		memcpy(name, key.name, sizeof(key.name));
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0) return -1;
+		if (!EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key, iv)) return -1;
+	} else {
+		result = tls->find_ticket_key(name, key);
+		if (!result) return 0;
+		if (!EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key, iv)) return -1;
+	}
+	char digest[] = "SHA256";
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, sizeof(key.hmac_key)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+		OSSL_PARAM_construct_end(),
+	};
+	if (!EVP_MAC_CTX_set_params(mac, params)) return -1;
+	return result;
+}
+
+// The client's most preferred protocol that we have, or none, which means HTTP/1.1
+static int
+alpn_callback(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg)
+{
+	auto tls = static_cast<TlsState *>(arg);
+	unsigned char *selected;
+	int status = SSL_select_next_proto(
+		&selected, outlen,
+		reinterpret_cast<const unsigned char *>(tls->alpn.data()), tls->alpn.size(),
+		in, inlen
+	);
+	if (status != OPENSSL_NPN_NEGOTIATED) return SSL_TLSEXT_ERR_NOACK;
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+TlsState::TlsState(const TlsConfig &config_)
+:
+	config(config_),
+	context(boost::asio::ssl::context::tls_server)
+{
+	context.set_options(
+		boost::asio::ssl::context::default_workarounds
+		| boost::asio::ssl::context::no_sslv2
+		| boost::asio::ssl::context::no_sslv3
+		| boost::asio::ssl::context::no_tlsv1
+		| boost::asio::ssl::context::no_tlsv1_1
+	);
+	context.use_certificate_chain_file(config.certificate_chain_file);
+	context.use_private_key_file(config.private_key_file, boost::asio::ssl::context::pem);
+	
+	SSL_CTX *ctx = context.native_handle();
+	SSL_CTX_set_ex_data(ctx, tls_state_index(), this);
+	
+	if (config.http2) alpn.append("\x02h2");
+	alpn.append("\x08http/1.1");
+	SSL_CTX_set_alpn_select_cb(ctx, alpn_callback, this);
+	
+	static const unsigned char session_id_context[] = "woof";
+	SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, config.session_cache_size);
+	SSL_CTX_set_timeout(ctx, config.session_timeout.count());
+	
+	if (config.ticket_key_rotation.count() > 0) {
+		new_ticket_key(ticket_keys[0]);
+		new_ticket_key(ticket_keys[1]);
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_callback);
+	} else {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+	}
+}
+
+// Resumed handshakes may not make new tickets, so it's checked whenever a key is used. After two
+// periods without any, the previous key is too old as well.
+void
+TlsState::rotate_ticket_keys()
+{
+	auto age = std::chrono::steady_clock::now() - ticket_keys[0].created;
+	if (age >= 2*config.ticket_key_rotation) {
+		new_ticket_key(ticket_keys[1]);
+		new_ticket_key(ticket_keys[0]);
+	} else if (age >= config.ticket_key_rotation) {
+		ticket_keys[1] = ticket_keys[0];
+		new_ticket_key(ticket_keys[0]);
+	}
+}
+
+TlsState::TicketKey
+TlsState::current_ticket_key()
+{
+	std::lock_guard lock(ticket_mutex);
+	rotate_ticket_keys();
+	return ticket_keys[0];
+}
+
+int
+TlsState::find_ticket_key(const unsigned char *name, TicketKey &key)
+{
+	std::lock_guard lock(ticket_mutex);
+	rotate_ticket_keys();
+	for (int i = 0; i < 2; ++i) {
+		if (memcmp(name, ticket_keys[i].name, sizeof(key.name)) == 0) {
+			key = ticket_keys[i];
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+Server &
+Server::tls(const TlsConfig &config)
+{
+	m->tls = std::make_shared<TlsState>(config);
+	return *this;
+}
+
+}
+
+#else
+
+namespace woof {
+
+Server &
+Server::tls(const TlsConfig &)
+{
+	throw std::logic_error("Woof was built without TLS support");
+}
+
+}
+
+#endif
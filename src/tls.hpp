@@ -0,0 +1,42 @@
+#ifndef _WOOF_tls_hpp
+#define _WOOF_tls_hpp
+
+#include "internal.hpp"
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+
+namespace woof {
+
+using TlsStream = boost::beast::ssl_stream<boost::beast::tcp_stream>;
+
+class TlsState {
+public:
+	// A session ticket key, RFC 5077 4
+	struct TicketKey {
+		unsigned char name[16];
+		unsigned char aes_key[32];
+		unsigned char hmac_key[32];
+		std::chrono::steady_clock::time_point created;
+	};
+	
+	TlsConfig config;
+	boost::asio::ssl::context context;
+	std::string alpn; // Our protocols, in order of preference, in the wire format
+	std::mutex ticket_mutex;
+	TicketKey ticket_keys[2]; // The current one and the previous one
+	
+	TlsState(const TlsConfig &config_);
+	
+	// For the ticket key callback. Both rotate the keys if it's time.
+	void rotate_ticket_keys();
+	TicketKey current_ticket_key();
+	// Returns 0 if there's no such key, 1 for the current one, and 2 for the previous one, whose
+	// tickets should be renewed
+	int find_ticket_key(const unsigned char *name, TicketKey &key);
+};
+
+}
+
+#endif
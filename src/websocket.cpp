@@ -0,0 +1,85 @@
+#include "internal.hpp"
+
+namespace woof {
+
+void
+Server::add_websocket(const PathPattern &path, const WebSocketHandlers &handlers)
+{
+	auto shared = std::make_shared<const WebSocketHandlers>(handlers);
+	auto &handler = add_handler(m, Method::GET, path);
+	handler.handler = [shared](Request &req, Response &) {
+		req.m->websocket = shared;
+	};
+	handler.takes_over = true;
+}
+
+Request &
+WebSocket::request() const
+{
+	return m->request;
+}
+
+bool
+WebSocket::send(std::string_view message, bool binary) const
+{
+	return m->send(std::make_shared<const std::string>(message), binary);
+}
+
+bool
+WebSocket::send(std::shared_ptr<const std::string> message, bool binary) const
+{
+	return m->send(std::move(message), binary);
+}
+
+void
+WebSocket::close() const
+{
+	m->close();
+}
+
+WebSocketHub::WebSocketHub()
+:
+	m(std::make_shared<WebSocketHubState>())
+{}
+
+void
+WebSocketHub::subscribe(const WebSocket &socket) const
+{
+	std::lock_guard lock(m->mutex);
+	m->subscribers.emplace(socket.m.get(), socket.m);
+}
+
+void
+WebSocketHub::unsubscribe(const WebSocket &socket) const
+{
+	std::lock_guard lock(m->mutex);
+	m->subscribers.erase(socket.m.get());
+}
+
+void
+WebSocketHub::broadcast(std::string_view message, bool binary) const
+{
+	auto shared = std::make_shared<const std::string>(message);
+	std::lock_guard lock(m->mutex);
+	for (auto it = m->subscribers.begin(); it != m->subscribers.end();) {
+		auto socket = it->second.lock();
+		if (!socket || socket->closed()) {
+			it = m->subscribers.erase(it);
+		} else if (!socket->send(shared, binary)) {
+			// A slow consumer
+			socket->abort();
+			it = m->subscribers.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+size_t
+WebSocketHub::size() const
+{
+	std::lock_guard lock(m->mutex);
+	return m->subscribers.size();
+}
+
+}
@@ -0,0 +1,240 @@
+#ifndef _WOOF_websocket_hpp
+#define _WOOF_websocket_hpp
+
+#include "connection.hpp"
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/websocket.hpp>
+#include <deque>
+
+namespace woof {
+
+namespace websocket = boost::beast::websocket;
+
+// Everything touching the stream runs on the strand, so the callbacks are called one at a time, and
+// send() and close() can be called from any thread
+template<class Stream>
+class WebSocketSession : public WebSocketState {
+	std::shared_ptr<const ServerState> m;
+	websocket::stream<Stream> ws;
+	boost::asio::strand<typename Stream::executor_type> strand;
+	std::shared_ptr<ConnectionSlot> slot; // Counts the connection while the session lasts
+	beast::flat_buffer buffer;
+	std::deque<std::pair<std::shared_ptr<const std::string>, bool>> queue;
+	bool writing = false;
+	bool closing = false;
+	std::atomic<bool> finished = false;
+	
+	std::shared_ptr<WebSocketSession>
+	self()
+	{ return std::static_pointer_cast<WebSocketSession>(shared_from_this()); }
+	
+	template<class F>
+	void
+	on_strand(F &&f)
+	{ boost::asio::dispatch(strand, std::forward<F>(f)); }
+	
+	// A completion handler that continues on the strand
+	template<class F>
+	auto
+	strand_handler(F f)
+	{
+		return [s = self(), f = std::move(f)](auto ...args) mutable {
+			s->on_strand([f = std::move(f), args...]() mutable { f(args...); });
+		};
+	}
+	
+	// Handler exceptions close the connection, they're only logged
+	void
+	handler_failed(const char *callback)
+	{
+		try {
+			throw;
+		} catch (const std::exception &e) {
+			m->error(std::string("WebSocket ") + callback + " handler threw: " + e.what());
+		} catch (...) {
+			m->error(std::string("WebSocket ") + callback + " handler threw");
+		}
+	}
+	
+	// Calls on_close once, whichever way the connection ended
+	void
+	finish()
+	{
+		if (finished.exchange(true)) return;
+		queue.clear();
+		if (handlers->on_close) {
+			WebSocket socket(self());
+			try {
+				handlers->on_close(socket);
+			} catch (...) {
+				handler_failed("on_close");
+			}
+		}
+	}
+	
+	void
+	read()
+	{
+		ws.async_read(buffer, strand_handler([s = self()](beast::error_code ec, size_t) {
+			if (ec) {
+				s->finish();
+				return;
+			}
+			if (s->handlers->on_message && !s->finished) {
+				auto data = s->buffer.data();
+				std::string_view message(static_cast<const char *>(data.data()), data.size());
+				WebSocket socket(s);
+				try {
+					s->handlers->on_message(socket, message, !s->ws.got_text());
+				} catch (...) {
+					s->handler_failed("on_message");
+					s->do_close(websocket::close_code::internal_error);
+				}
+			}
+			s->buffer.consume(s->buffer.size());
+			s->read();
+		}));
+	}
+	
+	void
+	write()
+	{
+		if (queue.empty()) {
+			if (closing) do_close(websocket::close_code::normal);
+			return;
+		}
+		writing = true;
+		auto &[message, binary] = queue.front();
+		ws.binary(binary);
+		ws.async_write(boost::asio::buffer(*message), strand_handler(
+			[s = self()](beast::error_code ec, size_t) {
+				s->writing = false;
+				if (ec) {
+					s->finish();
+					return;
+				}
+				s->queued_bytes -= s->queue.front().first->size();
+				s->queue.pop_front();
+				s->write();
+			}
+		));
+	}
+	
+	void
+	do_close(websocket::close_code code)
+	{
+		if (finished || !ws.is_open()) return;
+		closing = true;
+		if (writing) return;
+		ws.async_close(code, strand_handler([s = self()](beast::error_code) {
+			s->finish();
+		}));
+	}
+	
+public:
+	
+	WebSocketSession(
+		std::shared_ptr<const ServerState> m_,
+		std::shared_ptr<ConnectionState> state_,
+		std::shared_ptr<const WebSocketHandlers> handlers_,
+		Stream &&stream,
+		std::shared_ptr<ConnectionSlot> slot_
+	)
+	:
+		WebSocketState(std::move(state_), std::move(handlers_)),
+		m(std::move(m_)),
+		ws(std::move(stream)),
+		strand(ws.get_executor()),
+		slot(std::move(slot_))
+	{}
+	
+	void
+	run(http::request<http::string_body> upgrade)
+	{
+		// The websocket stream has its own timeouts and pings
+		if constexpr (requires { beast::get_lowest_layer(ws).expires_never(); }) {
+			beast::get_lowest_layer(ws).expires_never();
+		}
+		ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+		ws.read_message_max(handlers->max_message_bytes);
+		auto request = std::make_shared<http::request<http::string_body>>(std::move(upgrade));
+		on_strand([s = self(), request] {
+			s->ws.async_accept(*request, s->strand_handler([s, request](beast::error_code ec) {
+				if (ec) {
+					s->finished = true;
+					return;
+				}
+				if (s->handlers->on_open) {
+					WebSocket socket(s);
+					try {
+						s->handlers->on_open(socket);
+					} catch (...) {
+						s->handler_failed("on_open");
+						s->do_close(websocket::close_code::internal_error);
+					}
+				}
+				s->read();
+			}));
+		});
+	}
+	
+	virtual bool
+	send(std::shared_ptr<const std::string> message, bool binary) override
+	{
+		if (finished) return false;
+		if (queued_bytes.fetch_add(message->size()) + message->size() > handlers->max_queued_bytes) {
+			queued_bytes -= message->size();
+			return false;
+		}
+		on_strand([s = self(), message = std::move(message), binary]() mutable {
+			if (s->finished || s->closing) {
+				s->queued_bytes -= message->size();
+				return;
+			}
+			s->queue.emplace_back(std::move(message), binary);
+			if (!s->writing) s->write();
+		});
+		return true;
+	}
+	
+	virtual void
+	close() override
+	{
+		on_strand([s = self()] {
+			s->do_close(websocket::close_code::normal);
+		});
+	}
+	
+	virtual void
+	abort() override
+	{
+		on_strand([s = self()] {
+			beast::get_lowest_layer(s->ws).close();
+			s->finish();
+		});
+	}
+	
+	virtual bool
+	closed() const override
+	{ return finished; }
+};
+
+template<class Stream>
+void
+start_websocket(
+	std::shared_ptr<const ServerState> m,
+	std::shared_ptr<ConnectionState> state,
+	std::shared_ptr<const WebSocketHandlers> handlers,
+	Stream &stream,
+	std::shared_ptr<ConnectionSlot> slot,
+	http::request<http::string_body> upgrade
+)
+{
+	auto session = std::make_shared<WebSocketSession<Stream>>(std::move(m), std::move(state), std::move(handlers), std::move(stream), std::move(slot));
+	session->run(std::move(upgrade));
+}
+
+}
+
+#endif